@@ -0,0 +1,44 @@
+# Host (Linux) build of the Model01 hardware layer, for profiling and regression testing
+# off-target. The Arduino core, the AVR registers and the TWI module are replaced by the
+# stand-ins and the simulated bus in src/host. This needs a checkout of the Kaleidoglyph
+# core library for its headers:
+#
+#   make -f host.mk KALEIDOGLYPH_DIR=../Kaleidoglyph
+#
+# The result is a static library that test & benchmark programs can link against; they
+# drive the virtual scanners through kaleidoglyph::host::SimBus. `make -f host.mk check`
+# builds and runs the regression check in test/host against it.
+
+KALEIDOGLYPH_DIR ?= ../Kaleidoglyph
+BUILD_DIR        ?= build/host
+
+CXX      ?= g++
+CPPFLAGS += -DKALEIDOGLYPH_HOST -Isrc/host -Isrc -I$(KALEIDOGLYPH_DIR)/src \
+            -include Kaleidoglyph-Hardware-Model01.h
+CXXFLAGS ?= -std=gnu++11 -O2 -g -Wall
+
+SRCS := $(wildcard src/model01/*.cpp) $(wildcard src/host/*.cpp)
+OBJS := $(SRCS:%.cpp=$(BUILD_DIR)/%.o)
+LIB  := $(BUILD_DIR)/libkaleidoglyph-model01-host.a
+
+CHECK := $(BUILD_DIR)/check
+
+.PHONY: all check clean
+
+all: $(LIB)
+
+$(LIB): $(OBJS)
+	$(AR) rcs $@ $^
+
+check: $(CHECK)
+	$(CHECK)
+
+$(CHECK): test/host/check.cpp $(LIB)
+	$(CXX) $(CPPFLAGS) $(CXXFLAGS) $< $(LIB) -o $@
+
+$(BUILD_DIR)/%.o: %.cpp
+	@mkdir -p $(dir $@)
+	$(CXX) $(CPPFLAGS) $(CXXFLAGS) -c $< -o $@
+
+clean:
+	rm -rf $(BUILD_DIR)
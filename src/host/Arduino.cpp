@@ -0,0 +1,191 @@
+// Host implementation of the Arduino stand-ins declared in Arduino.h
+
+#if defined(KALEIDOGLYPH_HOST)
+
+#include <Arduino.h>
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "SimBus.h"
+
+volatile uint8_t SREG;
+
+volatile uint8_t TWBR;
+volatile uint8_t TWSR;
+volatile uint8_t TWCR;
+volatile uint8_t TWDR;
+volatile uint8_t TWAR;
+
+volatile uint8_t TCCR3A;
+volatile uint8_t TCCR3B;
+volatile uint8_t TIMSK3;
+volatile uint16_t TCNT3;
+volatile uint16_t OCR3A;
+
+volatile uint8_t UDCON;
+
+volatile uint8_t DDRB;
+volatile uint8_t DDRC;
+volatile uint8_t DDRD;
+volatile uint8_t DDRE;
+volatile uint8_t PORTB;
+volatile uint8_t PORTC;
+volatile uint8_t PORTD;
+volatile uint8_t PORTE;
+volatile uint8_t PINB;
+
+uint16_t host_boot_key;
+
+HostSerial Serial;
+
+// Defined by the hardware layer only if it uses the scan timer
+extern "C" void TIMER3_COMPA_vect(void) __attribute__((weak));
+
+namespace kaleidoglyph {
+namespace host {
+
+static uint64_t clock_ns{0};
+
+uint64_t nanos() {
+  return clock_ns;
+}
+
+// The period of Timer3's compare-match interrupt, or zero if it's not running. Only CTC
+// mode with a prescaler of 1, 8, 64, 256 or 1024 is supported.
+static uint64_t timer3Period() {
+  if (TIMER3_COMPA_vect == nullptr || (TIMSK3 & _BV(OCIE3A)) == 0 ||
+      (TCCR3B & _BV(WGM32)) == 0) {
+    return 0;
+  }
+  static constexpr uint16_t prescalers[] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  uint64_t prescaler = prescalers[TCCR3B & 0x07];
+  return (uint64_t(OCR3A) + 1) * prescaler * 1000000000 / F_CPU;
+}
+
+// Queued bus transactions complete in the background, so whenever time passes, any that
+// have finished by now need to be completed (this is what the TWI interrupt does). We
+// stop the clock at each one, so completion callbacks see the time they'd see in the
+// interrupt. The same goes for the timer interrupt. Interrupts don't nest (as on the
+// AVR), so while the timer handler is running, time passes for the bus only.
+static bool in_timer_isr{false};
+static uint64_t next_tick{0};
+
+void advanceNanos(uint64_t ns) {
+
+  uint64_t target = clock_ns + ns;
+  SimBus& bus = SimBus::instance();
+  while (true) {
+    if (! in_timer_isr) {
+      uint64_t period = timer3Period();
+      if (period == 0) {
+        next_tick = 0;
+      } else if (next_tick == 0) {
+        next_tick = clock_ns + period;
+      }
+    }
+    uint64_t tick = in_timer_isr ? 0 : next_tick;
+    uint64_t end = bus.nextCompletion();
+    if (end != 0 && end <= target && (tick == 0 || end <= tick)) {
+      clock_ns = std::max(clock_ns, end);
+      bus.poll();
+    } else if (tick != 0 && tick <= target) {
+      // The handler may take longer than a period; if so, the ticks it overran are lost,
+      // just as they would be on the AVR.
+      clock_ns = std::max(clock_ns, tick);
+      in_timer_isr = true;
+      TIMER3_COMPA_vect();
+      in_timer_isr = false;
+      uint64_t period = timer3Period();
+      next_tick = (period == 0) ? 0 : tick + period;
+      while (next_tick != 0 && next_tick <= clock_ns) {
+        next_tick += period;
+      }
+    } else {
+      break;
+    }
+  }
+  clock_ns = std::max(clock_ns, target);
+  bus.poll();
+}
+
+// Idle sleep lasts until the next interrupt: a bus transfer finishing, a Timer3 tick, or
+// the Timer0 overflow that counts millis() (every 1.024 ms)
+void sleepUntilInterrupt() {
+  static constexpr uint64_t timer0_ns = 1024000;
+  uint64_t wake = (clock_ns / timer0_ns + 1) * timer0_ns;
+  uint64_t end = SimBus::instance().nextCompletion();
+  if (end != 0 && end < wake) {
+    wake = end;
+  }
+  if (next_tick != 0 && next_tick < wake) {
+    wake = next_tick;
+  }
+  advanceNanos(wake - clock_ns);
+}
+
+} // namespace host {
+} // namespace kaleidoglyph {
+
+unsigned long millis() {
+  return kaleidoglyph::host::nanos() / 1000000;
+}
+
+unsigned long micros() {
+  return kaleidoglyph::host::nanos() / 1000;
+}
+
+void delay(unsigned long ms) {
+  kaleidoglyph::host::advanceNanos(uint64_t(ms) * 1000000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  kaleidoglyph::host::advanceNanos(uint64_t(us) * 1000);
+}
+
+
+size_t Print::print(const __FlashStringHelper* s) {
+  return print(reinterpret_cast<const char *>(s));
+}
+
+size_t Print::print(const char* s) {
+  return fputs(s, stdout) < 0 ? 0 : strlen(s);
+}
+
+size_t Print::print(char c) {
+  return fputc(c, stdout) < 0 ? 0 : 1;
+}
+
+size_t Print::print(int n, int base) {
+  return print(long(n), base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+  return print((unsigned long)(n), base);
+}
+
+size_t Print::print(long n, int base) {
+  if (n < 0 && base == DEC) {
+    return print('-') + print((unsigned long)(-n), base);
+  }
+  return print((unsigned long)(n), base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[8 * sizeof(n) + 1];
+  char* p = &buf[sizeof(buf) - 1];
+  *p = '\0';
+  do {
+    byte digit = n % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while (n != 0);
+  return print(p);
+}
+
+size_t Print::println() {
+  return print('\n');
+}
+
+#endif // #if defined(KALEIDOGLYPH_HOST)
@@ -0,0 +1,80 @@
+// -*- c++ -*-
+
+// This is a stand-in for the Arduino core, used for building the hardware layer on a
+// host (Linux) machine, with the simulated TWI bus in SimBus.cpp instead of the real
+// one. It only provides what the hardware layer actually uses. Time is virtual: it only
+// advances when something (a simulated bus transfer, or a call to delay()) consumes it,
+// so the numbers returned by millis() and micros() reflect bus costs, not host speed.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "binary.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define DEC 10
+#define HEX 16
+#define BIN  2
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class Print {
+ public:
+  size_t print(const __FlashStringHelper* s);
+  size_t print(const char* s);
+  size_t print(char c);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+
+  size_t println();
+  template <typename T>
+  size_t println(T value) {
+    size_t n = print(value);
+    return n + println();
+  }
+  template <typename T>
+  size_t println(T value, int base) {
+    size_t n = print(value, base);
+    return n + println();
+  }
+};
+
+class HostSerial : public Print {
+ public:
+  void begin(unsigned long) {}
+  operator bool() { return true; }
+};
+extern HostSerial Serial;
+
+namespace kaleidoglyph {
+namespace host {
+
+// The virtual clock, in nanoseconds since startup
+uint64_t nanos();
+void advanceNanos(uint64_t ns);
+// What sleep_mode() does (see avr/sleep.h)
+void sleepUntilInterrupt();
+
+} // namespace host {
+} // namespace kaleidoglyph {
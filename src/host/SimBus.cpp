@@ -0,0 +1,366 @@
+// Simulated TWI bus & scanner controllers for host builds (see SimBus.h)
+
+#if defined(KALEIDOGLYPH_HOST)
+
+#include "SimBus.h"
+
+#include <Arduino.h>
+
+#include "twi/wire-protocol-constants.h"
+
+
+namespace kaleidoglyph {
+namespace host {
+
+// --------------------------------------------------------------------------------
+// VirtualScanner
+
+void VirtualScanner::setKey(byte key, bool pressed) {
+  byte bank = keys_[key / 8];
+  if (pressed) {
+    bitSet(bank, key % 8);
+  } else {
+    bitClear(bank, key % 8);
+  }
+  if (bank != keys_[key / 8]) {
+    keys_[key / 8] = bank;
+    keys_changed_ = true;
+  }
+}
+
+void VirtualScanner::setKeys(const byte banks[4]) {
+  for (byte i{0}; i < 4; ++i) {
+    if (keys_[i] != banks[i]) {
+      keys_[i] = banks[i];
+      keys_changed_ = true;
+    }
+  }
+}
+
+bool VirtualScanner::receive(const byte* data, byte length) {
+  if (! present)
+    return false;
+  if (length == 0)
+    return true;
+
+  byte cmd = data[0];
+  if (cmd >= TWI_CMD_LED_BASE) {
+    byte bank = cmd - TWI_CMD_LED_BASE;
+    if (bank < 4) {
+      byte led = bank * 8;
+      for (byte i{1}; i + 2 < length && led < (bank + 1) * 8; i += 3, ++led) {
+        leds_[led] = WireColor{data[i], data[i + 1], data[i + 2]};
+      }
+      ++led_bank_writes;
+    }
+    return true;
+  }
+
+  switch (cmd) {
+    case TWI_CMD_VERSION:
+      register_pending_ = true;
+      register_value_   = version;
+      break;
+    case TWI_CMD_KEYSCAN_INTERVAL:
+      if (length > 1) {
+        keyscan_interval_ = data[1];
+      } else {
+        register_pending_ = true;
+        register_value_   = keyscan_interval_;
+      }
+      break;
+    case TWI_CMD_LED_SET_ALL_TO:
+      if (length > 3) {
+        for (WireColor& c : leds_) {
+          c = WireColor{data[1], data[2], data[3]};
+        }
+        ++led_all_writes;
+      }
+      break;
+    case TWI_CMD_LED_SET_ONE_TO:
+      if (length > 4 && data[1] < 32) {
+        leds_[data[1]] = WireColor{data[2], data[3], data[4]};
+        ++led_one_writes;
+      }
+      break;
+    case TWI_CMD_COLS_USE_PULLUPS:
+      if (length > 1) {
+        cols_use_pullups_ = data[1];
+      }
+      break;
+    case TWI_CMD_LED_SPI_FREQUENCY:
+      if (length > 1) {
+        led_spi_frequency_ = data[1];
+      } else {
+        register_pending_ = true;
+        register_value_   = led_spi_frequency_;
+      }
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+bool VirtualScanner::reply(byte* data, byte length) {
+  if (! present)
+    return false;
+  memset(data, 0, length);
+  if (length == 0)
+    return true;
+
+  if (register_pending_) {
+    data[0] = register_value_;
+    register_pending_ = false;
+  } else if (keys_changed_) {
+    data[0] = TWI_REPLY_KEYDATA;
+    for (byte i{1}; i < length && i <= 4; ++i) {
+      data[i] = keys_[i - 1];
+    }
+    keys_changed_ = false;
+    ++key_reports;
+  } else {
+    data[0] = TWI_REPLY_NONE;
+  }
+  return true;
+}
+
+void VirtualScanner::reset() {
+  *this = VirtualScanner(addr_);
+}
+
+// --------------------------------------------------------------------------------
+// SimBus
+
+SimBus& SimBus::instance() {
+  static SimBus bus;
+  return bus;
+}
+
+VirtualScanner* SimBus::find(byte addr) {
+  for (VirtualScanner& scanner : scanners_) {
+    if (scanner.address() == addr)
+      return &scanner;
+  }
+  return nullptr;
+}
+
+uint32_t SimBus::byteTime() const {
+  if (byte_ns_ != 0)
+    return byte_ns_;
+  // SCL frequency = F_CPU / (16 + 2 * TWBR), with the prescaler at 1; nine bit times
+  // per byte, including the ACK
+  uint32_t cycles_per_bit = 16 + 2 * uint32_t(TWBR);
+  return uint32_t(9ULL * cycles_per_bit * 1000000000ULL / F_CPU);
+}
+
+void SimBus::reset() {
+  scanners_[0].reset();
+  scanners_[1].reset();
+  byte_ns_      = 0;
+  transactions  = 0;
+  bytes         = 0;
+  nacks         = 0;
+  bus_errors    = 0;
+  busy_ns       = 0;
+  active_       = nullptr;
+  queue_head_   = nullptr;
+  queue_tail_   = nullptr;
+}
+
+// The time a transaction occupies the bus: the address byte plus the data, or just the
+// address byte if it gets NACKed.
+uint64_t SimBus::cost(const twi_txn* txn) const {
+  const VirtualScanner* scanner = const_cast<SimBus*>(this)->find(txn->address);
+  byte wire_bytes = 1;
+  if (scanner != nullptr && scanner->present)
+    wire_bytes += txn->length;
+  return overhead_ns + uint64_t(wire_bytes) * byteTime();
+}
+
+// Carry out a transfer with one of the virtual scanners. Returns a twi_writeTo() result
+// code, and sets `count` to the number of data bytes transferred.
+byte SimBus::transfer(byte addr, bool read, byte* data, byte length, byte& count) {
+  ++transactions;
+  ++bytes;
+  count = 0;
+  VirtualScanner* scanner = find(addr);
+  if (scanner != nullptr && scanner->present && TWBR < scanner->min_twbr) {
+    ++bus_errors;
+    return 4;
+  }
+  bool acked = false;
+  if (scanner != nullptr) {
+    acked = read ? scanner->reply(data, length) : scanner->receive(data, length);
+  }
+  if (! acked) {
+    ++nacks;
+    return 2;
+  }
+  count = length;
+  bytes += length;
+  return 0;
+}
+
+// A blocking transfer (twi_readFrom/twi_writeTo): wait for the queue to drain, then
+// occupy the bus for the whole transfer.
+byte SimBus::transferNow(byte addr, bool read, byte* data, byte length, byte& count) {
+  waitFor(nullptr);
+  twi_txn txn{nullptr, addr, byte(read ? TWI_TXN_READ : 0), data, length, 0, 0, nullptr, 0};
+  uint64_t t = cost(&txn);
+  byte result = transfer(addr, read, data, length, count);
+  advanceNanos(t);
+  busy_ns += t;
+  return result;
+}
+
+void SimBus::start(twi_txn* txn, uint64_t t) {
+  active_ = txn;
+  txn->status = TWI_TXN_ACTIVE;
+  active_end_ = t + cost(txn);
+  busy_ns += active_end_ - t;
+}
+
+void SimBus::submit(twi_txn* txn) {
+  txn->next  = nullptr;
+  txn->count = 0;
+  if (active_ == nullptr) {
+    start(txn, nanos());
+    return;
+  }
+  txn->status = TWI_TXN_QUEUED;
+  if (queue_tail_ != nullptr) {
+    queue_tail_->next = txn;
+  } else {
+    queue_head_ = txn;
+  }
+  queue_tail_ = txn;
+}
+
+// Complete every transaction whose end time has passed, starting the next queued one
+// where the previous one ended (this is what the TWI interrupt does on the real bus).
+void SimBus::poll() {
+  while (active_ != nullptr && nanos() >= active_end_) {
+    twi_txn* txn = active_;
+    uint64_t end = active_end_;
+    active_ = nullptr;
+    byte count;
+    if (txn->flags & TWI_TXN_HEADER) {
+      // The header byte goes in the descriptor, and the rest in the caller's buffer
+      byte reply[TWI_BUFFER_LENGTH];
+      txn->status = transfer(txn->address, true, reply, txn->length, count);
+      if (count != 0) {
+        txn->header = reply[0];
+        memcpy(txn->data, &reply[1], count - 1);
+      }
+    } else {
+      txn->status = transfer(txn->address, txn->flags & TWI_TXN_READ,
+                             txn->data, txn->length, count);
+    }
+    txn->count = count;
+    if (txn->callback != nullptr) {
+      txn->callback(txn);
+    }
+    if (active_ == nullptr && queue_head_ != nullptr) {
+      twi_txn* next = queue_head_;
+      queue_head_ = next->next;
+      if (queue_head_ == nullptr) {
+        queue_tail_ = nullptr;
+      }
+      start(next, end);
+    }
+  }
+}
+
+// Advance the virtual clock until `txn` is finished (or, with `txn == nullptr`, until
+// the queue is empty)
+void SimBus::waitFor(const twi_txn* txn) {
+  for (;;) {
+    poll();
+    if (txn != nullptr ? txn->status < TWI_TXN_QUEUED : idle())
+      return;
+    if (active_ == nullptr)
+      return;
+    advanceNanos(active_end_ - nanos());
+  }
+}
+
+} // namespace host {
+} // namespace kaleidoglyph {
+
+
+// --------------------------------------------------------------------------------
+// twi.h backend
+
+using kaleidoglyph::host::SimBus;
+
+extern "C" {
+
+void twi_init(void) {}
+void twi_disable(void) {}
+void twi_setAddress(uint8_t) {}
+
+void twi_setFrequency(uint32_t frequency) {
+  TWBR = ((F_CPU / frequency) - 16) / 2;
+}
+
+uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t) {
+  if (TWI_BUFFER_LENGTH < length)
+    return 0;
+  byte count;
+  SimBus::instance().transferNow(address, true, data, length, count);
+  return count;
+}
+
+uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t, uint8_t) {
+  if (TWI_BUFFER_LENGTH < length)
+    return 1;
+  byte count;
+  return SimBus::instance().transferNow(address, false, data, length, count);
+}
+
+uint8_t twi_transmit(const uint8_t*, uint8_t) {
+  return 2;  // never a slave transmitter
+}
+
+void twi_attachSlaveRxEvent(void (*)(uint8_t*, int)) {}
+void twi_attachSlaveTxEvent(void (*)(void)) {}
+void twi_reply(uint8_t) {}
+void twi_stop(void) {}
+void twi_releaseBus(void) {}
+
+uint8_t twi_submit(twi_txn* txn) {
+  if (txn->length == 0 || ! twi_isDone(txn))
+    return 1;
+  SimBus::instance().submit(txn);
+  return 0;
+}
+
+uint8_t twi_isDone(const twi_txn* txn) {
+  if (txn->status < TWI_TXN_QUEUED)
+    return true;
+  SimBus& bus = SimBus::instance();
+  bus.poll();
+  if (txn->status < TWI_TXN_QUEUED)
+    return true;
+  kaleidoglyph::host::advanceNanos(bus.poll_ns);
+  return false;
+}
+
+uint8_t twi_wait(twi_txn* txn) {
+  SimBus::instance().waitFor(txn);
+  return txn->status;
+}
+
+uint8_t twi_isIdle(void) {
+  SimBus& bus = SimBus::instance();
+  bus.poll();
+  if (bus.idle())
+    return true;
+  kaleidoglyph::host::advanceNanos(bus.poll_ns);
+  return false;
+}
+
+} // extern "C" {
+
+#endif // #if defined(KALEIDOGLYPH_HOST)
@@ -0,0 +1,155 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+extern "C" {
+#include "twi/twi.h"
+}
+
+
+namespace kaleidoglyph {
+namespace host {
+
+// A simulated scanner controller (the ATtiny88 in each half of the keyboard), speaking
+// the protocol in wire-protocol-constants.h. Key states are set directly by the test or
+// benchmark code, using the same bit layout as `KeyswitchData`; LED colors are stored as
+// they were sent on the wire (gamma-corrected, in B-G-R order).
+class VirtualScanner {
+ public:
+  explicit VirtualScanner(byte addr) : addr_(addr) {}
+
+  byte address() const {
+    return addr_;
+  }
+
+  // A scanner that isn't present NACKs its address, like an unplugged hand
+  bool present{true};
+
+  // A scanner with a long cable or weak pull-ups: with TWBR below this (i.e. a faster
+  // clock), every transfer to it fails with a bus error
+  byte min_twbr{0};
+
+  byte version{1};
+
+  struct WireColor {
+    byte b, g, r;
+  };
+
+  // Key state
+  void setKey(byte key, bool pressed);
+  void setKeys(const byte banks[4]);
+  bool key(byte key) const {
+    return bitRead(keys_[key / 8], key % 8);
+  }
+
+  // LED state, as received from the host
+  const WireColor& led(byte i) const {
+    return leds_[i];
+  }
+  byte keyscanInterval() const {
+    return keyscan_interval_;
+  }
+  byte ledSpiFrequency() const {
+    return led_spi_frequency_;
+  }
+
+  // Statistics
+  uint32_t key_reports{0};
+  uint32_t led_bank_writes{0};
+  uint32_t led_one_writes{0};
+  uint32_t led_all_writes{0};
+
+  // Bus side: the master writes a command, or reads a reply. These return false for an
+  // address NACK.
+  bool receive(const byte* data, byte length);
+  bool reply(byte* data, byte length);
+
+  void reset();
+
+ private:
+  byte addr_;
+  byte keys_[4]{};
+  bool keys_changed_{false};
+  WireColor leds_[32]{};
+  byte keyscan_interval_{50};
+  byte led_spi_frequency_{0};
+  byte cols_use_pullups_{0};
+
+  // A register read (e.g. TWI_CMD_VERSION without an argument) makes the next read return
+  // that register's value, instead of key data.
+  bool register_pending_{false};
+  byte register_value_{0};
+};
+
+
+// The simulated TWI bus. It implements the functions in twi.h, with two virtual scanners
+// at 0x58 (left) and 0x5B (right). Each transfer takes virtual time, calculated from the
+// number of bytes on the wire (including the address byte) and the time per byte, which
+// is derived from TWBR unless it's been set explicitly.
+//
+// Queued transactions (twi_submit) run "in the background": a transaction completes once
+// the virtual clock passes its end time, which happens when something waits for it, or
+// when the clock is advanced by other activity. Each poll of an unfinished transaction
+// (twi_isDone) costs `poll_ns`, to account for the time the CPU spends spinning.
+class SimBus {
+ public:
+  static SimBus& instance();
+
+  VirtualScanner& scanner(byte hand) {
+    return scanners_[hand];
+  }
+  VirtualScanner* find(byte addr);
+
+  // Time per byte on the wire (nine bit times). Zero means: derive it from TWBR.
+  void setByteTime(uint32_t ns) {
+    byte_ns_ = ns;
+  }
+  uint32_t byteTime() const;
+
+  // Extra time per transaction, for start & stop conditions
+  uint32_t overhead_ns{2000};
+  // CPU time charged for each poll of a transaction that isn't finished yet
+  uint32_t poll_ns{250};
+
+  // Statistics
+  uint32_t transactions{0};
+  uint32_t bytes{0};
+  uint32_t nacks{0};
+  uint32_t bus_errors{0};
+  uint64_t busy_ns{0};
+
+  void reset();
+
+  // twi.h backend
+  byte transfer(byte addr, bool read, byte* data, byte length, byte& count);
+  byte transferNow(byte addr, bool read, byte* data, byte length, byte& count);
+  void submit(twi_txn* txn);
+  void poll();
+  void waitFor(const twi_txn* txn);
+  bool idle() const {
+    return active_ == nullptr;
+  }
+  // When the transaction on the bus will be finished (or zero, if there isn't one)
+  uint64_t nextCompletion() const {
+    return (active_ == nullptr) ? 0 : active_end_;
+  }
+
+ private:
+  SimBus() : scanners_{VirtualScanner(0x58), VirtualScanner(0x58 | 3)} {}
+
+  VirtualScanner scanners_[2];
+  uint32_t byte_ns_{0};
+
+  uint64_t cost(const twi_txn* txn) const;
+  void start(twi_txn* txn, uint64_t t);
+
+  twi_txn* active_{nullptr};
+  uint64_t active_end_{0};
+  twi_txn* queue_head_{nullptr};
+  twi_txn* queue_tail_{nullptr};
+};
+
+} // namespace host {
+} // namespace kaleidoglyph {
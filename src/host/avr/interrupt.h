@@ -0,0 +1,13 @@
+// -*- c++ -*-
+
+// Host stand-in for <avr/interrupt.h>. There are no real interrupts on the host; the
+// simulated TWI bus calls completion callbacks itself, and the host clock calls the Timer3
+// compare-match handler (see avr/io.h). Handlers get C linkage, so the clock can find
+// them by name.
+
+#pragma once
+
+#define cli()
+#define sei()
+
+#define ISR(vector) extern "C" void vector(void)
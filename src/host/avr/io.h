@@ -0,0 +1,70 @@
+// -*- c++ -*-
+
+// Host stand-in for <avr/io.h>: the ATmega32U4 registers used by the hardware layer are
+// plain variables here. Writing to them has no effect, except for TWBR, which the
+// simulated TWI bus uses to work out its clock rate.
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) (sfr)
+
+extern volatile uint8_t SREG;
+
+// TWI
+extern volatile uint8_t TWBR;
+extern volatile uint8_t TWSR;
+extern volatile uint8_t TWCR;
+extern volatile uint8_t TWDR;
+extern volatile uint8_t TWAR;
+
+#define TWPS0 0
+#define TWPS1 1
+#define TWIE  0
+#define TWEN  2
+#define TWWC  3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA  6
+#define TWINT 7
+
+// Timer/Counter3. If its compare-match interrupt is enabled, the host clock calls
+// TIMER3_COMPA_vect() every (OCR3A + 1) ticks of the prescaled clock, in CTC mode only.
+extern volatile uint8_t TCCR3A;
+extern volatile uint8_t TCCR3B;
+extern volatile uint8_t TIMSK3;
+extern volatile uint16_t TCNT3;
+extern volatile uint16_t OCR3A;
+
+#define CS30   0
+#define CS31   1
+#define CS32   2
+#define WGM32  3
+#define OCIE3A 1
+
+// USB
+extern volatile uint8_t UDCON;
+
+#define DETACH 0
+
+// GPIO
+extern volatile uint8_t DDRB;
+extern volatile uint8_t DDRC;
+extern volatile uint8_t DDRD;
+extern volatile uint8_t DDRE;
+extern volatile uint8_t PORTB;
+extern volatile uint8_t PORTC;
+extern volatile uint8_t PORTD;
+extern volatile uint8_t PORTE;
+extern volatile uint8_t PINB;
+
+// RAM: the Caterina bootloader's magic key lives at a fixed address, which doesn't exist
+// here, so it gets a variable of its own
+extern uint16_t host_boot_key;
+#define MAGIC_KEY_POS (&host_boot_key)
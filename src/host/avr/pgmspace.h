@@ -0,0 +1,14 @@
+// -*- c++ -*-
+
+// Host stand-in for <avr/pgmspace.h>: there's only one address space here.
+
+#pragma once
+
+#include <string.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t *>(addr))
+
+#define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
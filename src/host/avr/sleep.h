@@ -0,0 +1,11 @@
+// -*- c++ -*-
+
+// Host stand-in for <avr/sleep.h>. There's only one sleep mode here: the virtual clock
+// skips ahead to the next interrupt (see kaleidoglyph::host::sleepUntilInterrupt()).
+
+#pragma once
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode)
+#define sleep_mode() kaleidoglyph::host::sleepUntilInterrupt()
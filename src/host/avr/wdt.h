@@ -0,0 +1,10 @@
+// -*- c++ -*-
+
+// Host stand-in for <avr/wdt.h>
+
+#pragma once
+
+#define WDTO_120MS 3
+
+#define wdt_enable(timeout)
+#define wdt_disable()
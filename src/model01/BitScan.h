@@ -0,0 +1,85 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// A 64-bit bitfield, one bit per keyswitch, in the same layout as the key scan data: bit
+// `n` of byte `b` is keyswitch `(b * 8) + n` (this relies on the MCU being little-endian,
+// which both AVR and x86 are). The byte view is there so that the AVR versions of the
+// functions below can work on one register at a time, instead of using 64-bit
+// arithmetic, which is slow on an 8-bit MCU.
+union Bits64 {
+  uint64_t bits;
+  byte bytes[8];
+};
+
+// Returns the index of the lowest set bit in `b`, which must not be zero. This is a
+// three-step binary search, which is cheaper on AVR than a loop or a lookup table (the
+// first shift is a single `swap` instruction).
+inline byte findFirstSet8(byte b) {
+  byte n{0};
+  if ((b & 0x0F) == 0) {
+    n += 4;
+    b >>= 4;
+  }
+  if ((b & 0x03) == 0) {
+    n += 2;
+    b >>= 2;
+  }
+  if ((b & 0x01) == 0) {
+    n += 1;
+  }
+  return n;
+}
+
+// Returns the number of set bits in `b`
+inline byte countBits8(byte b) {
+  b = b - ((b >> 1) & 0x55);
+  b = (b & 0x33) + ((b >> 2) & 0x33);
+  return (b + (b >> 4)) & 0x0F;
+}
+
+// Returns the index of the lowest set bit in `b`, which must not be zero
+inline byte findFirstSet(const Bits64& b) {
+#if defined(__AVR__)
+  // Skip over whole bytes of zeros first. Usually only one key has changed, so this is
+  // one compare per clean bank, and never touches a 64-bit value.
+  byte i{0};
+  while (b.bytes[i] == 0) {
+    ++i;
+  }
+  return (i * 8) + findFirstSet8(b.bytes[i]);
+#elif defined(__GNUC__)
+  return __builtin_ctzll(b.bits);
+#else
+  uint64_t bits = b.bits;
+  byte n{0};
+  while ((bits & 0xFF) == 0) {
+    bits >>= 8;
+    n += 8;
+  }
+  return n + findFirstSet8(byte(bits));
+#endif
+}
+
+// Clears the lowest set bit in `b`
+inline void clearFirstSet(Bits64& b) {
+#if defined(__AVR__)
+  for (byte& x : b.bytes) {
+    if (x != 0) {
+      x &= x - 1;
+      return;
+    }
+  }
+#else
+  b.bits &= b.bits - 1;
+#endif
+}
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
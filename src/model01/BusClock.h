@@ -0,0 +1,78 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// TWI bus clock settings, and the logic for deciding when to recalibrate. The bus work
+// itself is done by Keyboard::calibrateBusClock(), which tries each setting in turn,
+// starting with the slowest, and stops at the first one that gets any errors from either
+// scanner. Then it backs off by `margin` settings from the fastest one that worked, so
+// we're not running right at the edge.
+//
+// The fastest setting is TWBR = 10 (444kHz), which is as low as the ATmega's datasheet
+// allows for master mode. With the default margin of one, a keyboard with good cables
+// ends up at 400kHz, which is what it has always used.
+//
+// Both scanners share the bus, so there's only one clock; the slower hand sets the pace.
+class BusClock {
+ public:
+  static constexpr byte settings = 7;
+
+  // SCL frequency = F_CPU / (16 + 2 * TWBR): 100, 200, 267, 320, 364, 400 & 444 kHz
+  static byte twbr(byte setting) {
+    static constexpr PROGMEM byte twbr_values[settings] = {72, 32, 22, 17, 14, 12, 10};
+    return pgm_read_byte(&twbr_values[setting]);
+  }
+
+  // The setting used until the first calibration (400kHz)
+  static constexpr byte default_setting = 5;
+
+  // The number of round trips (a readVersion() and a readKeys()) to each scanner at each
+  // setting; any error disqualifies it
+  byte trials{4};
+  byte margin{1};
+
+  // If `auto_recalibrate` is on, the error counters get checked every `check_interval`
+  // ms, and if they've gone up by `error_threshold` or more since the last check, the
+  // Keyboard recalibrates. This blocks scanning for a few tens of milliseconds.
+  bool auto_recalibrate{true};
+  uint16_t check_interval{1000};
+  uint16_t error_threshold{8};
+
+  byte setting() const {
+    return setting_;
+  }
+
+  // Call once per scan cycle, with the sum of the scanners' error counts. Returns true if
+  // it's time to recalibrate.
+  bool update(uint16_t errors, uint16_t now) {
+    if (! auto_recalibrate || uint16_t(now - last_check_) < check_interval) {
+      return false;
+    }
+    last_check_ = now;
+    uint16_t new_errors = errors - last_errors_;
+    last_errors_ = errors;
+    return new_errors >= error_threshold;
+  }
+
+  // Calibration results. `fastest` is the fastest setting that got no errors, and the one
+  // that gets used is `margin` settings slower than that.
+  void set(byte fastest, uint16_t errors, uint16_t now) {
+    setting_ = (fastest > margin) ? (fastest - margin) : 0;
+    last_errors_ = errors;
+    last_check_ = now;
+  }
+
+ private:
+  byte setting_{default_setting};
+  uint16_t last_errors_{0};
+  uint16_t last_check_{0};
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
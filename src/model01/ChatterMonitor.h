@@ -0,0 +1,113 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "model01/BitScan.h"
+#include "model01/KeyAddr.h"
+#include "model01/KeyAddrSet.h"
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// Chatter detection for worn keyswitches. The Keyboard feeds it each scan cycle's
+// changes, and it counts each keyswitch's transitions in fixed windows of `window` ms. A
+// keyswitch that makes `threshold` transitions within one window is chattering (the
+// defaults work out to 16 Hz, which is faster than anyone types one key), and gets
+// quarantined. Quarantine is sticky, so the set of bad switches can be read out in the
+// field; release() (Keyboard::releaseChatteringKey()) lets one back out, e.g. after it's
+// been cleaned.
+//
+// If filtering is on, and MODEL01_DEBOUNCE is enabled, quarantined keyswitches get the
+// Debouncer's strictest treatment (see Debouncer::setStrictKeys()), while all the others
+// keep the fast path. Without the Debouncer, the monitor only reports.
+//
+// A scan cycle with no changes costs one timer comparison. The counters saturate, so a
+// keyswitch that goes on chattering can't wrap around to a low count.
+class ChatterMonitor {
+ public:
+  uint16_t window{250};
+  byte threshold{8};
+
+  // Whether quarantined keyswitches should get stricter filtering
+  bool filtering() const {
+    return filtering_;
+  }
+  void setFiltering(bool filtering) {
+    filtering_ = filtering;
+    changed_ = true;
+  }
+
+  // Field diagnostics: the keyswitches that have been quarantined, how many times a
+  // keyswitch has been quarantined in total (this only goes up), and the number of
+  // transitions a keyswitch has made in the current window.
+  const KeyAddrSet& quarantined() const {
+    return quarantined_;
+  }
+  bool isQuarantined(KeyAddr k) const {
+    return quarantined_.contains(k);
+  }
+  uint16_t quarantineCount() const {
+    return quarantine_count_;
+  }
+  byte transitions(KeyAddr k) const {
+    return counts_[byte(k)];
+  }
+
+  void release(KeyAddr k) {
+    quarantined_.remove(k);
+    counts_[byte(k)] = 0;
+    changed_ = true;
+  }
+  void releaseAll() {
+    quarantined_ = KeyAddrSet{};
+    memset(counts_, 0, sizeof(counts_));
+    changed_ = true;
+  }
+
+  // The keyswitches that need stricter filtering right now
+  KeyAddrSet strictKeys() const {
+    return filtering_ ? quarantined_ : KeyAddrSet{};
+  }
+
+  // Call once per scan cycle, with the keyswitches that changed state. Returns true if
+  // strictKeys() has changed since the last call.
+  bool update(const Bits64& changes, uint16_t now) {
+    if (uint16_t(now - window_start_) >= window) {
+      window_start_ = now;
+      memset(counts_, 0, sizeof(counts_));
+    }
+    Bits64 keys{changes};
+    while (keys.bits != 0) {
+      byte addr = findFirstSet(keys);
+      clearFirstSet(keys);
+      byte& count = counts_[addr];
+      if (count < 0xFF) {
+        ++count;
+      }
+      if (count >= threshold && ! quarantined_.contains(KeyAddr(addr))) {
+        quarantined_.add(KeyAddr(addr));
+        ++quarantine_count_;
+        changed_ = true;
+      }
+    }
+    bool changed = changed_;
+    changed_ = false;
+    return changed;
+  }
+
+ private:
+  byte counts_[total_keys] = {};
+  uint16_t window_start_{0};
+
+  KeyAddrSet quarantined_;
+  uint16_t quarantine_count_{0};
+
+  bool filtering_{true};
+  bool changed_{false};
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
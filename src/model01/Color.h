@@ -14,58 +14,136 @@ namespace kaleidoglyph {
 // commands to the LED controller module, and that's handled by the functions that make
 // those calls, not this struct.
 
-// TODO: consider changing this two a two-byte struct as a bitfield with 5 bits per
-// color. This would save space at the cost of speed. Would need to scale up to 8 bits by
-// multiplying by 8 (three-bit shift). To change that, it would make sense to change from
-// struct to class, and make the data members private.
+// A Color is packed into two bytes, with five bits per channel: red in bits 0-4, green in
+// bits 5-9, and blue in bits 10-14 (bit 15 is always zero). Keeping it in a single
+// integer means that equality is a single compare, and that the color math functions
+// below can work on all three channels at once, with 16-bit integer operations, instead
+// of one channel at a time.
 
 class Color {
 
  private:
-  byte r_ : 5, g_ : 5, b_ : 5;
+  uint16_t raw_;
+
+  static constexpr uint16_t r_mask = 0x001F;
+  static constexpr uint16_t g_mask = 0x03E0;
+  static constexpr uint16_t b_mask = 0x7C00;
 
  public:
   // Public interface functions, using 8-bit values. The secondary two-bit shift is used
   // so that we get the full range from zero to 255, even though the values are only 5
   // bits internally.
-  byte red  () const { return (r_ << 3) | (r_ >> 2); }
-  byte green() const { return (g_ << 3) | (g_ >> 2); }
-  byte blue () const { return (b_ << 3) | (g_ >> 2); }
+  byte red  () const { return (r() << 3) | (r() >> 2); }
+  byte green() const { return (g() << 3) | (g() >> 2); }
+  byte blue () const { return (b() << 3) | (b() >> 2); }
 
-  void red  (byte r8) { r_ = r8 >> 3; }
-  void green(byte g8) { g_ = g8 >> 3; }
-  void blue (byte b8) { b_ = b8 >> 3; }
+  void red  (byte r8) { r(r8 >> 3); }
+  void green(byte g8) { g(g8 >> 3); }
+  void blue (byte b8) { b(b8 >> 3); }
 
   // This is tricky -- these functions shouldn't be used outside the hardware module, so
   // they should probably be private, accessible to the Scanner class as a friend. These
   // access the 5-bit color values directly.
-  byte r() const { return r_; }
-  byte g() const { return g_; }
-  byte b() const { return b_; }
+  byte r() const { return  raw_            & 0x1F; }
+  byte g() const { return (raw_ >>  5)     & 0x1F; }
+  byte b() const { return (raw_ >> (5 + 5)) & 0x1F; }
+
+  void r(byte r5) { raw_ = (raw_ & ~r_mask) | ((uint16_t(r5) & 0x1F)            ); }
+  void g(byte g5) { raw_ = (raw_ & ~g_mask) | ((uint16_t(g5) & 0x1F) <<  5      ); }
+  void b(byte b5) { raw_ = (raw_ & ~b_mask) | ((uint16_t(b5) & 0x1F) << (5 + 5)); }
 
-  void r(byte r5) { r_ = r5; }
-  void g(byte g5) { g_ = g5; }
-  void b(byte b5) { b_ = b5; }
+  // The packed value
+  constexpr uint16_t raw() const { return raw_; }
 
   Color() = default;
 
   constexpr
-  Color(byte r8, byte g8, byte b8) : r_(r8 >> 3),
-                                     g_(g8 >> 3),
-                                     b_(b8 >> 3)  {}
+  Color(byte r8, byte g8, byte b8) : raw_((uint16_t(r8 >> 3)            ) |
+                                          (uint16_t(g8 >> 3) <<  5      ) |
+                                          (uint16_t(b8 >> 3) << (5 + 5))  ) {}
 
   constexpr
-  Color(uint16_t raw) : r_(raw           ),
-                        g_(raw >>  5     ),
-                        b_(raw >> (5 + 5))  {}
+  Color(uint16_t raw) : raw_(raw & (r_mask | g_mask | b_mask)) {}
 
   bool operator!=(const Color& other) const {
-    return ((this->r_ != other.r_) ||
-            (this->g_ != other.g_) ||
-            (this->b_ != other.b_)   );
+    return this->raw_ != other.raw_;
   }
   bool operator==(const Color& other) const {
-    return !(*this != other);
+    return this->raw_ == other.raw_;
+  }
+
+  // Color math. Each of these works on all three channels at once. "Level" and "amount"
+  // parameters are 8-bit values, where 255 means 100%, but since each channel only has
+  // five bits, they get rounded to 1/32 steps.
+
+  // Add two colors, with each channel saturating at its maximum
+  static Color add(Color a, Color c) {
+    // The high bit of each channel
+    constexpr uint16_t h_bits = 0x4210;
+    uint16_t x = a.raw_;
+    uint16_t y = c.raw_;
+    // Add the low four bits of each channel, then the high bits without carrying out of
+    // the channel. Then find the channels that overflowed, and fill them with ones.
+    uint16_t sum = ((x & ~h_bits) + (y & ~h_bits)) ^ ((x ^ y) & h_bits);
+    uint16_t carry = ((x & y) | ((x | y) & ~sum)) & h_bits;
+    return Color(uint16_t(sum | ((carry << 1) - (carry >> 4))));
+  }
+
+  // Scale the brightness of a color. Red & blue get multiplied together, with ten bits
+  // between them to hold the products, and green by itself.
+  static Color scale(Color a, byte level) {
+    byte n = scaleFactor(level);
+    uint32_t rb = (uint32_t(a.raw_ & (r_mask | b_mask)) * n) >> 5;
+    uint16_t  g = (uint16_t(a.raw_ & g_mask) * n) >> 5;
+    return Color(uint16_t((rb & (r_mask | b_mask)) | (g & g_mask)));
+  }
+
+  // Blend from `a` towards `c`: with an amount of zero, the result is `a`, and with 255,
+  // it's `c`.
+  static Color blend(Color a, Color c, byte amount) {
+    byte n = scaleFactor(amount);
+    byte m = 32 - n;
+    uint32_t rb = ((uint32_t(a.raw_ & (r_mask | b_mask)) * m) +
+                   (uint32_t(c.raw_ & (r_mask | b_mask)) * n)   ) >> 5;
+    uint16_t  g = ((uint16_t(a.raw_ & g_mask) * m) +
+                   (uint16_t(c.raw_ & g_mask) * n)   ) >> 5;
+    return Color(uint16_t((rb & (r_mask | b_mask)) | (g & g_mask)));
+  }
+
+  // The average of two colors (rounded down). The bits they share count in full, and the
+  // others count for half, shifted down without the low bit of each channel, so it can't
+  // spill into the next one.
+  static Color average(Color a, Color c) {
+    constexpr uint16_t not_low_bits = 0x7BDE;
+    return Color(uint16_t((a.raw_ & c.raw_) + (((a.raw_ ^ c.raw_) & not_low_bits) >> 1)));
+  }
+
+  // Bulk versions, for a whole bank of eight LEDs at a time
+  static void add(Color (&bank)[8], Color c) {
+    for (Color& a : bank) {
+      a = add(a, c);
+    }
+  }
+  static void scale(Color (&bank)[8], byte level) {
+    for (Color& a : bank) {
+      a = scale(a, level);
+    }
+  }
+  static void blend(Color (&bank)[8], const Color (&target)[8], byte amount) {
+    for (byte i{0}; i < 8; ++i) {
+      bank[i] = blend(bank[i], target[i], amount);
+    }
+  }
+  static void average(Color (&bank)[8], const Color (&other)[8]) {
+    for (byte i{0}; i < 8; ++i) {
+      bank[i] = average(bank[i], other[i]);
+    }
+  }
+
+ private:
+  // Convert an 8-bit level (0-255) to a multiplier out of 32
+  static byte scaleFactor(byte level) {
+    return (uint16_t(level) + 1) >> 3;
   }
 };
 
@@ -0,0 +1,91 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "model01/BitScan.h"
+#include "model01/KeyAddr.h"
+#include "model01/KeyAddrSet.h"
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// A debouncer for the whole key matrix, built on "vertical" counters: each keyswitch has
+// a two-bit counter, but the counters are stored bit-sliced, with bit 0 of eight
+// keyswitches' counters in one byte, and bit 1 in another. That way, each bank of eight
+// keys is debounced with a handful of bitwise operations, no matter how many of them are
+// changing.
+//
+// A keyswitch's debounced state changes when its raw state has differed from it for
+// `threshold` consecutive scans (deferred), or immediately (eager), depending on the
+// policy for that direction. The usual choice is eager press and deferred release: a
+// press is reported on the very first scan that sees it, and the chatter that follows is
+// ignored because the release has to be stable to be reported.
+class Debouncer {
+ public:
+  Debouncer() = default;
+
+  // Set the number of consecutive scans (1-4) a change must be seen for, when deferred
+  void setThreshold(byte scans) {
+    threshold_ = (scans < 1) ? 0 : (scans > 4) ? 3 : scans - 1;
+  }
+  byte threshold() const {
+    return threshold_ + 1;
+  }
+
+  void setPolicy(bool eager_press, bool eager_release) {
+    eager_press_   = eager_press   ? 0xFF : 0x00;
+    eager_release_ = eager_release ? 0xFF : 0x00;
+  }
+
+  // Keyswitches that get the strictest treatment, whatever the threshold & policy are:
+  // both directions deferred, for four scans. This is for switches that chatter too much
+  // for the usual settings (see ChatterMonitor.h).
+  void setStrictKeys(const KeyAddrSet& keys) {
+    strict_.bits = keys.bits();
+  }
+
+  // Run one debounce step for one bank of keyswitches: `raw` is the latest reading, and
+  // `state` is the debounced state, which gets updated in place.
+  void update(byte bank, byte raw, byte& state) {
+    byte c0 = count0_[bank];
+    byte c1 = count1_[bank];
+
+    // keyswitches whose raw state differs from their debounced state
+    byte delta = raw ^ state;
+
+    // keyswitches whose counters have reached the threshold (which is the maximum, for
+    // the strict ones)
+    byte strict = strict_.bytes[bank];
+    byte settled = ((threshold_ & 1) ? c0 : byte(~c0)) & ((threshold_ & 2) ? c1 : byte(~c1));
+    settled = (settled & ~strict) | (c0 & c1 & strict);
+
+    byte eager  = ((raw & eager_press_) | (~raw & eager_release_)) & ~strict;
+    byte toggle = delta & (eager | settled);
+    state ^= toggle;
+    delta &= ~toggle;
+
+    // count up where the raw state (still) differs, and reset everywhere else
+    count1_[bank] = (c1 ^ c0) & delta;
+    count0_[bank] = ~c0 & delta;
+  }
+
+ private:
+  static constexpr byte total_banks_ = total_keys / 8;
+
+  byte count0_[total_banks_] = {};
+  byte count1_[total_banks_] = {};
+
+  // threshold minus one, i.e. the counter value at which a change is accepted
+  byte threshold_{2};
+
+  byte eager_press_{0xFF};
+  byte eager_release_{0x00};
+
+  Bits64 strict_{0};
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
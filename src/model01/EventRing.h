@@ -0,0 +1,61 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// A single-producer, single-consumer ring buffer of key events, for passing them from the
+// scan timer's interrupt to the main loop without disabling interrupts. Each event is one
+// byte: the KeyAddr in the low six bits, and the new state in the top bit. The producer
+// only ever writes `head_`, and the consumer only ever writes `tail_`; both are single
+// bytes, so reading and writing them is atomic on AVR. One entry is always left empty,
+// to tell a full ring from an empty one.
+template <byte size>
+class EventRing {
+  static_assert((size & (size - 1)) == 0, "EventRing size must be a power of two");
+
+ public:
+  static constexpr byte pressed_bit = 0x80;
+  static constexpr byte addr_mask   = 0x3F;
+
+  bool empty() const {
+    return head_ == tail_;
+  }
+
+  // Producer side. Returns false (and drops the event) if the ring is full.
+  bool push(byte event) {
+    byte head = head_;
+    byte next = (head + 1) & (size - 1);
+    if (next == tail_) {
+      return false;
+    }
+    events_[head] = event;
+    head_ = next;
+    return true;
+  }
+
+  // Consumer side. Returns false if there's nothing there.
+  bool pop(byte& event) {
+    byte tail = tail_;
+    if (tail == head_) {
+      return false;
+    }
+    event = events_[tail];
+    tail_ = (tail + 1) & (size - 1);
+    return true;
+  }
+
+ private:
+  // These are all volatile, so that the compiler can't move the write of an event past
+  // the update of `head_` that publishes it
+  volatile byte events_[size];
+  volatile byte head_{0};
+  volatile byte tail_{0};
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
@@ -4,6 +4,8 @@
 
 #include <Arduino.h>
 
+#include "model01/Layout.h"
+
 
 namespace kaleidoglyph {
 
@@ -43,10 +45,22 @@ class KeyAddr {
     return addr_;
   }
 
-  constexpr
-  byte row() const;
-  constexpr
-  byte col() const;
+  // The physical position of the key (see Layout.h). Rows go from 0 to 5, and columns
+  // from 0 to 17 (left hand 0-8, right hand 9-17).
+  byte row() const {
+    return hardware::layout::row(hardware::layout::keyPos(addr_));
+  }
+  byte col() const {
+    return hardware::layout::col(hardware::layout::keyPos(addr_));
+  }
+
+  // The key at a given physical position. If there isn't one, the result is invalid.
+  static KeyAddr fromCoords(byte row, byte col) {
+    using namespace hardware::layout;
+    if (row >= total_rows || col >= total_cols)
+      return KeyAddr{invalid};
+    return KeyAddr{posKey(pos(row, col))};
+  }
 
   constexpr
   bool isValid() const {
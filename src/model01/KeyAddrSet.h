@@ -0,0 +1,126 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "model01/BitScan.h"
+#include "model01/KeyAddr.h"
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// A set of keyswitches, one bit per KeyAddr, in the same layout as the scan data (see
+// BitScan.h). Checking a chord is one or two word-wide operations, instead of a call to
+// Keyboard::keyswitchState() for each key:
+//
+//   KeyAddrSet chord = KeyAddrSet{} + KeyAddr(3) + KeyAddr(12) + KeyAddr(40);
+//   if (keyboard.pressedKeys().containsAll(chord)) { ... }
+//
+// Iterating over a set visits only the keys in it, lowest address first:
+//
+//   for (KeyAddr k : keyboard.pressedThisScan()) { ... }
+class KeyAddrSet {
+ public:
+  constexpr KeyAddrSet() : keys_{0} {}
+  explicit constexpr KeyAddrSet(uint64_t bits) : keys_{bits} {}
+
+  uint64_t bits() const {
+    return keys_.bits;
+  }
+
+  bool empty() const {
+    return keys_.bits == 0;
+  }
+  byte count() const {
+    byte n{0};
+    for (byte b : keys_.bytes) {
+      n += countBits8(b);
+    }
+    return n;
+  }
+
+  bool contains(KeyAddr k) const {
+    return bitRead(keys_.bytes[byte(k) / 8], byte(k) % 8);
+  }
+  bool containsAll(const KeyAddrSet& other) const {
+    return (other.keys_.bits & ~keys_.bits) == 0;
+  }
+  bool containsAny(const KeyAddrSet& other) const {
+    return (other.keys_.bits & keys_.bits) != 0;
+  }
+
+  void add(KeyAddr k) {
+    bitSet(keys_.bytes[byte(k) / 8], byte(k) % 8);
+  }
+  void remove(KeyAddr k) {
+    bitClear(keys_.bytes[byte(k) / 8], byte(k) % 8);
+  }
+
+  KeyAddrSet operator+(KeyAddr k) const {
+    KeyAddrSet result{*this};
+    result.add(k);
+    return result;
+  }
+
+  // Union, intersection & difference
+  KeyAddrSet& operator|=(const KeyAddrSet& other) {
+    keys_.bits |= other.keys_.bits;
+    return *this;
+  }
+  KeyAddrSet& operator&=(const KeyAddrSet& other) {
+    keys_.bits &= other.keys_.bits;
+    return *this;
+  }
+  KeyAddrSet& operator-=(const KeyAddrSet& other) {
+    keys_.bits &= ~other.keys_.bits;
+    return *this;
+  }
+  KeyAddrSet operator|(const KeyAddrSet& other) const {
+    return KeyAddrSet{keys_.bits | other.keys_.bits};
+  }
+  KeyAddrSet operator&(const KeyAddrSet& other) const {
+    return KeyAddrSet{keys_.bits & other.keys_.bits};
+  }
+  KeyAddrSet operator-(const KeyAddrSet& other) const {
+    return KeyAddrSet{keys_.bits & ~other.keys_.bits};
+  }
+
+  bool operator==(const KeyAddrSet& other) const {
+    return keys_.bits == other.keys_.bits;
+  }
+  bool operator!=(const KeyAddrSet& other) const {
+    return keys_.bits != other.keys_.bits;
+  }
+
+  // The iterator works on its own copy of the bits, and clears each one as it goes
+  class Iterator {
+   public:
+    explicit Iterator(const Bits64& keys) : keys_(keys) {}
+    bool operator!=(const Iterator& other) const {
+      return keys_.bits != other.keys_.bits;
+    }
+    KeyAddr operator*() const {
+      return KeyAddr(findFirstSet(keys_));
+    }
+    void operator++() {
+      clearFirstSet(keys_);
+    }
+   private:
+    Bits64 keys_;
+  };
+
+  Iterator begin() const {
+    return Iterator{keys_};
+  }
+  Iterator end() const {
+    return Iterator{Bits64{0}};
+  }
+
+ private:
+  Bits64 keys_;
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
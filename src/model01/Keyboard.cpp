@@ -1,6 +1,8 @@
 #include "Keyboard.h"
 
 #include <Arduino.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <avr/wdt.h>
 
 #include "model01/Color.h"
@@ -17,6 +19,22 @@ namespace hardware {
 
 
 void Keyboard::scanMatrix() {
+#if MODEL01_TIMER_SCAN
+  // The interrupt does the scanning, so the idle wait can come first: an event that
+  // arrives during it ends it, and the activity check in scanCycle() wakes us up.
+  idleWait(millis());
+  scanCycle();
+#else
+  // The idle wait (if any) comes after the reads have been queued, so they arrive while
+  // we sleep, and get collected right away on the next call
+  uint16_t start = millis();
+  scanCycle();
+  idleWait(start);
+#endif
+}
+
+void Keyboard::scanCycle() {
+  MODEL01_PROFILE(scan_matrix);
 
   // I'm tempted to abuse this function and include the LED updating here, but it should
   // probably be done the hard way with a plugin. I'm going to do it anyway to simplify
@@ -25,29 +43,627 @@ void Keyboard::scanMatrix() {
   // really be used to keep them from updating too often.
   //syncLeds();
 
-  // copy current keyswitch state array to previous
-  //memcpy(&prev_scan_, &curr_scan_, sizeof(prev_scan_));
-  prev_scan_ = curr_scan_;
+#if MODEL01_TIMER_SCAN
+  delivered_before_ = delivered_;
+
+  // The scanning itself happens in the timer interrupt. These things need the bus to
+  // themselves, so the timer gets stopped while they run.
+  byte sreg = SREG;
+  cli();
+  uint16_t errors = totalScannerErrors();
+  SREG = sreg;
+  bool recalibrate = bus_clock_.update(errors, millis());
+  if (hand_missing_[0] || hand_missing_[1] || recalibrate) {
+    stopScanTimer();
+    if (hand_missing_[0] || hand_missing_[1]) {
+      probeMissingHands();
+    }
+    if (recalibrate) {
+      calibrateBusClock();
+    }
+    startScanTimer();
+  }
+  updateActivity();
+  return;
+#endif
+
+  if (hand_missing_[0] || hand_missing_[1]) {
+    probeMissingHands();
+  }
+
+#if MODEL01_PIPELINED_SCAN
+  // If nothing iterated over the right hand during the last cycle, collect it now
+  finishScan();
+  ++pipeline_stats_.cycles;
+
+  // the current scan becomes the previous one
+  advanceScan();
+
+  // The left hand's read was queued by finishScan() while the previous cycle's
+  // right-hand events were being processed, so it has usually arrived already.
+  if (waitForKeys(0)) {
+    ++pipeline_stats_.left_ready;
+  }
+  collectHand(0);
+
+  // Queue the right hand's read; it will be collected by finishScan() when the Iterator
+  // reaches the right hand's banks, after it has finished with the left hand.
+  requestHand(1);
+  right_scan_pending_ = true;
+#else
+  // the current scan becomes the previous one
+  advanceScan();
+
+  // The reads are asynchronous: we collect the key data from the ones that were queued on
+  // the previous call, then queue the next ones and return without waiting for the bus.
+  // If a read is still in progress (or failed), that hand's state is unchanged for this
+  // cycle.
 
   // scan left hand
-  scanners_[0].readKeys(curr_scan_.hands[0]);
+  collectHand(0);
+  requestHand(0);
 
   // scan right hand
-  scanners_[1].readKeys(curr_scan_.hands[1]);
+  collectHand(1);
+  requestHand(1);
+#endif
+
+  // This comes last, so that any key data the calibration reads gets reported as part of
+  // this scan cycle
+  if (bus_clock_.update(totalScannerErrors(), millis())) {
+    calibrateBusClock();
+  }
+  recordTransitions();
+
+  // The activity check goes by the key data we've just collected, so a key report that
+  // ends a power-down wakes us up on this cycle, without waiting out another idle period
+  updateActivity();
+}
+
+// Check whether a new key report has arrived from one hand's scanner. If it has, it's
+// already in place, so all we have to do is switch to its slot.
+bool Keyboard::receiveHand(byte hand) {
+  if (! scanners_[hand].collectKeys()) {
+    return false;
+  }
+  key_report_ = true;
+#if MODEL01_DEBOUNCE
+  raw_slot_[hand] ^= 1;
+#else
+  curr_slot_[hand] = next_slot_[hand];
+#endif
+  return true;
+}
+
+// Collect the key data from one hand's scanner (if a new report has arrived), and update
+// that hand's half of the current scan state. With debouncing enabled, this runs every
+// scan cycle, whether or not there's a new report, because the debounce counters count
+// scan cycles. The debounced state goes into a free slot, which only becomes the
+// current one if something changed.
+void Keyboard::collectHand(byte hand) {
+  MODEL01_PROFILE(read_keys);
+  if (hand_missing_[hand]) {
+    return;
+  }
+  receiveHand(hand);
+#if MODEL01_DEBOUNCE
+  const KeyswitchHand& raw  = raw_slots_[hand][raw_slot_[hand]];
+  const KeyswitchHand& curr = scan_slots_[hand][curr_slot_[hand]];
+  byte slot = freeSlot(hand);
+  KeyswitchHand& next = scan_slots_[hand][slot];
+  byte bank = hand * sizeof(KeyswitchData);
+  for (byte i{0}; i < sizeof(KeyswitchData); ++i, ++bank) {
+    byte state = curr.keys.banks[i];
+    debouncer_.update(bank, raw.keys.banks[i], state);
+    next.keys.banks[i] = state;
+  }
+  if (next.bits != curr.bits) {
+    curr_slot_[hand] = slot;
+  }
+#endif
+  if (scanners_[hand].consecutiveReadFailures() >= missing_after_failures) {
+    detachHand(hand);
+  }
+}
+
+// Queue a key read from one hand, into a slot that isn't in use
+void Keyboard::requestHand(byte hand) {
+  if (hand_missing_[hand]) {
+    return;
+  }
+#if MODEL01_DEBOUNCE
+  scanners_[hand].requestKeys(raw_slots_[hand][raw_slot_[hand] ^ 1].keys);
+#else
+  byte slot = freeSlot(hand);
+  if (scanners_[hand].requestKeys(scan_slots_[hand][slot].keys)) {
+    next_slot_[hand] = slot;
+  }
+#endif
+}
+
+// Wait (with a time limit) until there's nothing on the bus. Returns false if it's still
+// busy after `bus_idle_timeout_us`.
+bool Keyboard::waitForBusIdle() {
+  uint16_t start = micros();
+  while (! twi_isIdle()) {
+    if (uint16_t(uint16_t(micros()) - start) >= bus_idle_timeout_us)
+      return false;
+  }
+  return true;
+}
+
+// A blocking read of one hand, for the bus clock calibration. The calibration has the
+// bus to itself, so once it's idle, the read is done. Returns false if it never finished.
+bool Keyboard::readHand(byte hand) {
+  requestHand(hand);
+  if (! waitForBusIdle())
+    return false;
+  receiveHand(hand);
+  return true;
+}
+
+// Stop talking to a hand that has gone away. Its keys get cleared, so anything that was
+// held when it was unplugged gets released on this scan cycle, instead of being stuck.
+// This can run in the timer interrupt, so it can't wait for a key read that's still on
+// the bus; instead, the cleared keys go in a slot that the read isn't writing into.
+void Keyboard::detachHand(byte hand) {
+  hand_missing_[hand] = true;
+  last_probe_ = millis();
+  byte slot = freeSlot(hand);
+#if ! MODEL01_DEBOUNCE
+  // (With debouncing, reads go into the raw slots instead)
+  if (slot == next_slot_[hand] && ! scanners_[hand].keysReady()) {
+    byte curr = curr_slot_[hand];
+    slot = (curr != prev_slot_[hand]) ? curr : (3 - curr - slot);
+  }
+#endif
+  scan_slots_[hand][slot].bits = 0;
+  curr_slot_[hand] = slot;
+#if MODEL01_DEBOUNCE
+  raw_slots_[hand][raw_slot_[hand]].bits = 0;
+#endif
+}
+
+void Keyboard::calibrateBusClock() {
+#if MODEL01_TIMER_SCAN
+  // This might get called from outside with the scan timer running, and it needs the bus
+  // to itself
+  bool timer_running = TIMSK3 & _BV(OCIE3A);
+  stopScanTimer();
+#endif
+
+  // Collect any key reports that are already on their way, so they don't get lost. If the
+  // bus never goes idle, it's stuck, and there's no point in calibrating now.
+  bool idle = waitForBusIdle();
+  for (byte hand{0}; idle && hand < 2; ++hand) {
+    if (handPresent(hand)) {
+      receiveHand(hand);
+    }
+  }
+  if (! idle) {
+#if MODEL01_TIMER_SCAN
+    if (timer_running) {
+      startScanTimer();
+    }
+#endif
+    return;
+  }
+
+  // The trials at settings that are too fast fail on purpose, so the error counts get
+  // put back afterwards. Otherwise they'd show up in errorStats(), and the bus clock's
+  // baseline for auto-recalibration would include them.
+  TwiErrorStats saved_errors[2] = {scanners_[0].errorStats(), scanners_[1].errorStats()};
+
+  // Get each scanner's version at the slowest clock, to check the other reads against.
+  // One that doesn't answer even then is missing.
+  byte versions[2];
+  TWBR = BusClock::twbr(0);
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (! handPresent(hand)) {
+      continue;
+    }
+    versions[hand] = scanners_[hand].readVersion();
+    if (versions[hand] == byte(-1)) {
+      detachHand(hand);
+    }
+  }
+
+  byte fastest{0};
+  for (byte setting{0}; setting < BusClock::settings; ++setting) {
+    TWBR = BusClock::twbr(setting);
+    if (! busClockWorks(versions)) {
+      break;
+    }
+    fastest = setting;
+  }
+
+  // The failures at the settings that were too fast don't count against the scanners
+  for (byte hand{0}; hand < 2; ++hand) {
+    scanners_[hand].clearBackoff();
+    scanners_[hand].restoreErrorStats(saved_errors[hand]);
+  }
+  bus_clock_.set(fastest, totalScannerErrors(), millis());
+  TWBR = BusClock::twbr(bus_clock_.setting());
+
+#if MODEL01_TIMER_SCAN
+  if (timer_running) {
+    startScanTimer();
+  }
+#endif
 }
 
+// Try some round trips to each scanner at the current bus clock, and return true if they
+// all worked. Any key data that comes back is kept, just like in a normal scan.
+bool Keyboard::busClockWorks(const byte versions[2]) {
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (! handPresent(hand)) {
+      continue;
+    }
+    Scanner& scanner = scanners_[hand];
+    for (byte i{0}; i < bus_clock_.trials; ++i) {
+      scanner.clearBackoff();
+      uint16_t errors = scanner.errorStats().total();
+      if (scanner.readVersion() != versions[hand]) {
+        return false;
+      }
+      if (! readHand(hand) || scanner.errorStats().total() != errors) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Check on the missing hands, and bring back any that answer. A scanner that has just
+// been plugged in has been powered down, so its LEDs are all off, and its keyscan
+// interval is back to its default.
+void Keyboard::probeMissingHands() {
+  uint16_t now = millis();
+  if (uint16_t(now - last_probe_) < probe_interval_ms) {
+    return;
+  }
+  last_probe_ = now;
+
+  // The probes use the slowest clock, in case the hand went missing because the clock
+  // was too fast for it. If one comes back, the clock gets recalibrated with it. If the
+  // bus is stuck, this waits for the next probe interval.
+  if (! waitForBusIdle()) {
+    return;
+  }
+  TWBR = BusClock::twbr(0);
+  bool reattached{false};
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (! hand_missing_[hand] || ! scanners_[hand].probe()) {
+      continue;
+    }
+    hand_missing_[hand] = false;
+    // Drop any report from a read that finished after the hand was detached; it's older
+    // than the cleared keys
+    scanners_[hand].collectKeys();
+    if (keyscan_interval_ != KeyscanGovernor::no_change) {
+      scanners_[hand].setKeyscanInterval(keyscan_interval_);
+    }
+    scanners_[hand].markAllLedsChanged();
+    reattached = true;
+  }
+  if (reattached && bus_clock_.auto_recalibrate) {
+    calibrateBusClock();
+  } else {
+    TWBR = BusClock::twbr(bus_clock_.setting());
+  }
+}
+
+// Report this scan cycle's activity to the power-down state machine and the
+// keyscan governor, and send the new keyscan interval to the scanners if the governor
+// decides to change it. A key that's being held counts as activity, so we don't slow
+// down while waiting for its release. Waking up comes first, so that the governor can
+// speed up from the interval we had before powering down.
+void Keyboard::updateActivity() {
+#if MODEL01_TIMER_SCAN
+  // The scan state belongs to the interrupt, so we go by the events instead
+  bool active = (delivered_.bits != 0) || ! events_.empty();
+#else
+  uint64_t curr = currScan();
+  bool active = (curr != 0) || (curr != prevScan());
+#endif
+  switch (power_down_.update(active, millis())) {
+    case PowerDown::power_down:
+      enterPowerDown();
+      break;
+    case PowerDown::wake_up:
+      exitPowerDown();
+      break;
+    default:
+      break;
+  }
+
+  if (! keyscan_governor_.enabled) {
+    return;
+  }
+  byte interval = keyscan_governor_.update(active, millis());
+  if (interval != KeyscanGovernor::no_change) {
+    setKeyscanInterval(interval);
+  }
+}
+
+// While powered down, scanning slows down to one cycle every `idle_scan_period` ms, so
+// this waits out the rest of the period that began at `start`. Any interrupt wakes the
+// MCU (the tick that counts millis(), a TWI transfer finishing, USB), so it goes back to
+// sleep until the time is up. A cycle that got a key report doesn't wait at all: with
+// debouncing, the report might not have changed the state yet, and the debouncer needs
+// the next cycles to come quickly. In timer mode, the wait ends as soon as there's an
+// event for the main loop.
+void Keyboard::idleWait(uint16_t start) {
+#if MODEL01_TIMER_SCAN
+  bool report = ! events_.empty();
+#else
+  bool report = key_report_;
+  key_report_ = false;
+#endif
+  if (! power_down_.poweredDown() || report) {
+    return;
+  }
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  while (uint16_t(uint16_t(millis()) - start) < power_down_.idle_scan_period) {
+#if MODEL01_TIMER_SCAN
+    if (! events_.empty()) {
+      return;
+    }
+#endif
+    if (power_down_.sleep) {
+      sleep_mode();
+    }
+  }
+}
+
+void Keyboard::enterPowerDown() {
+  // If we've never set the interval, the scanners are still at their own default, which
+  // we need to know to go back to it. If the read fails, the governor's slow interval is
+  // the best guess.
+  wake_keyscan_interval_ = keyscan_interval_;
+  if (wake_keyscan_interval_ == KeyscanGovernor::no_change) {
+    byte hand = handPresent(0) ? 0 : 1;
+    wake_keyscan_interval_ = scanners_[hand].readKeyscanInterval();
+  }
+  if (wake_keyscan_interval_ == KeyscanGovernor::no_change) {
+    wake_keyscan_interval_ = keyscan_governor_.slow_interval;
+  }
+  setKeyscanInterval(power_down_.idle_keyscan_interval);
+
+  // The stored colors stay as they are, so they can be sent again on waking up
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (handPresent(hand)) {
+      scanners_[hand].showAllLeds(power_down_.idle_color);
+    }
+  }
+  if (power_down_.limit_led_power) {
+    disableHighPowerLeds();
+  }
+#if MODEL01_TIMER_SCAN
+  // Restart it at the idle rate
+  stopScanTimer();
+  startScanTimer();
+#endif
+}
+
+void Keyboard::exitPowerDown() {
+#if MODEL01_TIMER_SCAN
+  stopScanTimer();
+  startScanTimer();
+#endif
+  if (power_down_.limit_led_power) {
+    enableHighPowerLeds();
+  }
+  setKeyscanInterval(wake_keyscan_interval_);
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (handPresent(hand)) {
+      scanners_[hand].markAllLedsChanged();
+    }
+  }
+}
+
+void Keyboard::scanMatrix(KeyswitchChanges& changes) {
+  scanMatrix();
+#if MODEL01_TIMER_SCAN
+  // Drain the ring. If a key changed more than once, it's only reported once if it ended
+  // up in a different state, and not at all if it's back where it started.
+  Bits64 before = delivered_;
+  KeyAddr k;
+  KeyState state;
+  while (nextEvent(k, state)) {}
+  changes.pressed = delivered_;
+  changes.changed.bits = delivered_.bits ^ before.bits;
+#else
+  finishScan();
+  changes.pressed.bits = currScan();
+  changes.changed.bits = changes.pressed.bits ^ prevScan();
+#endif
+}
+
+KeyAddrSet Keyboard::pressedKeys() {
+#if MODEL01_TIMER_SCAN
+  return KeyAddrSet{delivered_.bits};
+#else
+  finishScan();
+  return KeyAddrSet{currScan()};
+#endif
+}
+
+KeyAddrSet Keyboard::pressedThisScan() {
+#if MODEL01_TIMER_SCAN
+  return KeyAddrSet{delivered_.bits & ~delivered_before_.bits};
+#else
+  finishScan();
+  return KeyAddrSet{currScan() & ~prevScan()};
+#endif
+}
+
+KeyAddrSet Keyboard::releasedThisScan() {
+#if MODEL01_TIMER_SCAN
+  return KeyAddrSet{delivered_before_.bits & ~delivered_.bits};
+#else
+  finishScan();
+  return KeyAddrSet{prevScan() & ~currScan()};
+#endif
+}
+
+#if MODEL01_PIPELINED_SCAN
+// Wait for the read from one hand to finish. Returns `true` if it had already finished
+// (i.e. it was completely overlapped with other work), and `false` if we had to wait.
+bool Keyboard::waitForKeys(byte hand) {
+  if (scanners_[hand].keysReady()) {
+    return true;
+  }
+  uint32_t t0 = micros();
+  while (! scanners_[hand].keysReady()) {
+    continue;
+  }
+  pipeline_stats_.wait_us += micros() - t0;
+  return false;
+}
+
+// Collect the right hand's data for the current scan cycle, and queue the read of the
+// left hand for the next one.
+void Keyboard::finishScan() {
+  if (! right_scan_pending_) {
+    return;
+  }
+  right_scan_pending_ = false;
+  if (waitForKeys(1)) {
+    ++pipeline_stats_.right_ready;
+  }
+  collectHand(1);
+  requestHand(0);
+  recordTransitions();
+}
+#endif
+
 // return the state of the keyswitch as a bitfield
 KeyState Keyboard::keyswitchState(KeyAddr k) const {
   byte r = byte(k) / 8;
   byte c = byte(k) % 8;
-  return KeyState(bitRead(curr_scan_.banks[r], c),
-                  bitRead(prev_scan_.banks[r], c));
+#if MODEL01_TIMER_SCAN
+  // This is the state as of the last event the main loop has seen
+  bool state = bitRead(delivered_.bytes[r], c);
+  return KeyState(state, state);
+#else
+  return KeyState(bitRead(currBank(r), c),
+                  bitRead(prevBank(r), c));
+#endif
 }
 
+#if MODEL01_CHATTER_MONITOR
+void Keyboard::releaseChatteringKey(KeyAddr k) {
+  byte sreg = SREG;
+  cli();
+  chatter_monitor_.release(k);
+  SREG = sreg;
+}
+
+void Keyboard::releaseChatteringKeys() {
+  byte sreg = SREG;
+  cli();
+  chatter_monitor_.releaseAll();
+  SREG = sreg;
+}
+
+void Keyboard::setChatterFiltering(bool filtering) {
+  byte sreg = SREG;
+  cli();
+  chatter_monitor_.setFiltering(filtering);
+  SREG = sreg;
+}
+
+void Keyboard::setChatterLimits(uint16_t window, byte threshold) {
+  byte sreg = SREG;
+  cli();
+  chatter_monitor_.window    = window;
+  chatter_monitor_.threshold = threshold;
+  SREG = sreg;
+}
+#endif
+
+#if MODEL01_KEY_TIMESTAMPS || MODEL01_CHATTER_MONITOR
+void Keyboard::recordTransitions() {
+  uint16_t now = millis();
+  Bits64 changes{currScan() ^ recorded_.bits};
+  recorded_.bits ^= changes.bits;
+
+#if MODEL01_CHATTER_MONITOR
+  if (chatter_monitor_.update(changes, now)) {
+#if MODEL01_DEBOUNCE
+    debouncer_.setStrictKeys(chatter_monitor_.strictKeys());
+#endif
+  }
+#endif
+
+#if MODEL01_KEY_TIMESTAMPS
+  while (changes.bits != 0) {
+    key_times_[findFirstSet(changes)] = now;
+    clearFirstSet(changes);
+  }
+  uint16_t& oldest = key_times_[next_to_age_];
+  if (uint16_t(now - oldest) > max_key_age) {
+    oldest = now - max_key_age;
+  }
+  next_to_age_ = (next_to_age_ + 1) % total_keys;
+#endif
+}
+#endif
+
+#if MODEL01_KEY_TIMESTAMPS
+uint16_t Keyboard::timeInState(KeyAddr k, bool pressed) const {
+  byte addr = byte(k);
+#if MODEL01_TIMER_SCAN
+  // In timer mode, the interrupt records transitions before the caller has seen them
+  // with nextEvent(), so go by the state it has seen. The interrupt also writes the
+  // stamps, and a 16-bit read isn't atomic.
+  bool state = bitRead(delivered_.bytes[addr / 8], addr % 8);
+  byte sreg = SREG;
+  cli();
+  uint16_t stamp = key_times_[addr];
+  SREG = sreg;
+#else
+  bool state = bitRead(recorded_.bytes[addr / 8], addr % 8);
+  uint16_t stamp = key_times_[addr];
+#endif
+  if (state != pressed) {
+    return 0;
+  }
+  uint16_t age = uint16_t(millis()) - stamp;
+  return (age > max_key_age) ? max_key_age : age;
+}
+#endif
 
 static constexpr byte HAND_BIT = B00100000;
 static constexpr byte LED_BITS = B00011111;
 
+#if MODEL01_LED_DOUBLE_BUFFER
+// With double buffering, these functions only ever touch the back frame. The front frame
+// is the one stored in the scanner objects.
+Color Keyboard::getLedColor(LedAddr led) const {
+  return back_frame_[byte(led)];
+}
+
+void Keyboard::setLedColor(LedAddr led, Color color) {
+  back_frame_[byte(led)] = color;
+}
+
+// A frame is still being sent if either scanner has changes that haven't gone out yet, or
+// a write that hasn't finished. Once both are idle, we copy the whole back frame at once,
+// so syncLeds() can't send part of it before the rest is there.
+bool Keyboard::commitFrame() {
+  if ((handPresent(0) && scanners_[0].ledsPending()) ||
+      (handPresent(1) && scanners_[1].ledsPending())) {
+    return false;
+  }
+  for (byte led{0}; led < TOTAL_LEDS; ++led) {
+    bool hand = led & HAND_BIT;
+    scanners_[hand].setLedColor(led & LED_BITS, back_frame_[led]);
+  }
+  return true;
+}
+#else
 Color Keyboard::getLedColor(LedAddr led) const {
   bool hand = byte(led) & HAND_BIT; // B00100000
   return scanners_[hand].getLedColor(byte(led) & LED_BITS);
@@ -57,34 +673,202 @@ void Keyboard::setLedColor(LedAddr led, Color color) {
   bool hand = byte(led) & HAND_BIT; // B00100000
   scanners_[hand].setLedColor(byte(led) & LED_BITS, color);
 }
+#endif
+
+void Keyboard::setLedColors(LedMask64 leds, Color color) {
+#if MODEL01_LED_DOUBLE_BUFFER
+  Bits64 mask{leds};
+  while (mask.bits != 0) {
+    back_frame_[findFirstSet(mask)] = color;
+    clearFirstSet(mask);
+  }
+#else
+  scanners_[0].setLedColors(uint32_t(leds), color);
+  scanners_[1].setLedColors(uint32_t(leds >> 32), color);
+#endif
+}
+
+// We translate the keys to LEDs first, so that the scanners can do each bank at once
+void Keyboard::setKeyColors(KeyMask64 keys, Color color) {
+  Bits64 mask{keys};
+  Bits64 leds{0};
+  while (mask.bits != 0) {
+    byte led = layout::keyLed(findFirstSet(mask));
+    bitSet(leds.bytes[led / 8], led % 8);
+    clearFirstSet(mask);
+  }
+  setLedColors(leds.bits, color);
+}
+
+void Keyboard::setLedRange(LedAddr begin, LedAddr end, Color color) {
+  if (byte(begin) >= byte(end) || byte(begin) >= total_leds)
+    return;
+  // every LED from `begin` up, minus every LED from `end` up
+  LedMask64 leds = ~LedMask64(0) << byte(begin);
+  if (byte(end) < total_leds) {
+    leds &= ~(~LedMask64(0) << byte(end));
+  }
+  setLedColors(leds, color);
+}
+
+void Keyboard::setRowColor(byte row, Color color) {
+  if (row < layout::total_rows)
+    setLedColors(layout::rowLeds(row), color);
+}
 
-Color Keyboard::getKeyColor(KeyAddr k) const {
-  return getLedColor(LedAddr{k});
+void Keyboard::setColColor(byte col, Color color) {
+  if (col < layout::total_cols)
+    setLedColors(layout::colLeds(col), color);
 }
 
-void Keyboard::setKeyColor(KeyAddr k, Color color) {
-  setLedColor(LedAddr{k}, color);
+#if MODEL01_LED_PALETTE
+Color Keyboard::getPaletteColor(byte index) const {
+  return Scanner::getPaletteColor(index);
 }
 
+void Keyboard::setPaletteColor(byte index, Color color) {
+  if (index >= Scanner::palette_size || Scanner::getPaletteColor(index) == color)
+    return;
+  Scanner::setPaletteColor(index, color);
+  scanners_[0].markPaletteEntries(uint16_t(1) << index);
+  scanners_[1].markPaletteEntries(uint16_t(1) << index);
+}
+
+void Keyboard::setPalette(const Color palette[Scanner::palette_size]) {
+  uint16_t changed{0};
+  for (byte i{0}; i < Scanner::palette_size; ++i) {
+    if (Scanner::getPaletteColor(i) != palette[i]) {
+      Scanner::setPaletteColor(i, palette[i]);
+      bitSet(changed, i);
+    }
+  }
+  if (changed != 0) {
+    scanners_[0].markPaletteEntries(changed);
+    scanners_[1].markPaletteEntries(changed);
+  }
+}
+
+byte Keyboard::getLedPaletteIndex(LedAddr led) const {
+  bool hand = byte(led) & HAND_BIT;
+  return scanners_[hand].getLedIndex(byte(led) & LED_BITS);
+}
+
+void Keyboard::setLedPaletteIndex(LedAddr led, byte index) {
+  bool hand = byte(led) & HAND_BIT;
+  scanners_[hand].setLedIndex(byte(led) & LED_BITS, index);
+}
+#endif
+
 // Update one bank of LEDs on each scanner, and advance the counter for the next
-// call. Returns `true` if the whole keyboard has been sync'd, `false` otherwise.
+// call. Returns `true` if the whole keyboard has been sync'd, `false` otherwise. The bank
+// writes are queued on the TWI bus, so this doesn't wait for them; if a scanner's
+// previous write hasn't finished yet, we stay on the same bank and try again next time.
 bool Keyboard::syncLeds() {
-  static byte next_led_bank{0};
+  // Nothing gets sent while powered down; it all goes out after waking up
+  if (power_down_.poweredDown()) {
+    return true;
+  }
+  MODEL01_PROFILE(sync_leds);
+  // First, check whether setting all of a scanner's LEDs at once (and then fixing up the
+  // ones that differ) would be cheaper than sending the changes bank by bank. If so, the
+  // bank updates below will wait for that write to finish.
+  // Missing hands are skipped; their LEDs all get sent when they come back.
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (handPresent(hand)) {
+      scanners_[hand].updateAllLedsIfCheaper();
+    }
+  }
 
-  scanners_[0].updateLedBank(next_led_bank);
-  scanners_[1].updateLedBank(next_led_bank);
-  ++next_led_bank;
+  bool left_sent  = hand_missing_[0] || scanners_[0].updateLedBank(next_led_bank_);
+  bool right_sent = hand_missing_[1] || scanners_[1].updateLedBank(next_led_bank_);
+  if (! (left_sent && right_sent)) {
+    return false;
+  }
+  ++next_led_bank_;
 
-  if (next_led_bank < total_led_banks) {
+  if (next_led_bank_ < total_led_banks) {
     return false;
   }
-  next_led_bank = 0;
+  next_led_bank_ = 0;
   return true;
 }
 
+// The time estimates come from the scanners' measured write throughput. Each scanner only
+// has one LED write on the bus at a time, and we never wait for one to finish: a scanner
+// that's still busy gets skipped, so its banks wait for a later call, and the other hand
+// gets a turn. That also keeps us from sending a scanner writes back to back, which it
+// tends to NACK.
+bool Keyboard::syncLedsOneWritePerHand(uint16_t budget_us) {
+  if (power_down_.poweredDown()) {
+    return true;
+  }
+  MODEL01_PROFILE(sync_leds);
+  uint16_t spent{0};
+  for (byte hand{0}; hand < 2; ++hand) {
+    uint16_t cost = Scanner::ledAllWriteMicros();
+    if (handPresent(hand) && spent + cost <= budget_us &&
+        scanners_[hand].updateAllLedsIfCheaper()) {
+      spent += cost;
+    }
+  }
+
+  uint16_t now = millis();
+  while (true) {
+    bool found{false};
+    bool waiting{false};
+    byte hand{0}, bank{0};
+    uint16_t oldest{0};
+    for (byte h{0}; h < 2; ++h) {
+      // A scanner that's missing, or backing off after an error, won't send anything
+      if (hand_missing_[h] || scanners_[h].backingOff())
+        continue;
+      for (byte b{0}; b < total_led_banks; ++b) {
+        if (! scanners_[h].ledBankDirty(b))
+          continue;
+        if (scanners_[h].ledWriteBusy()) {
+          waiting = true;
+          break;
+        }
+        uint16_t age = now - scanners_[h].ledBankDirtySince(b);
+        if (! found || age > oldest) {
+          found = true;
+          oldest = age;
+          hand = h;
+          bank = b;
+        }
+      }
+    }
+    if (! found) {
+      return ! waiting;
+    }
+
+    // We always send at least one write, so a budget that's too small (or a bad
+    // estimate) can't stall the LEDs completely
+    uint16_t cost = scanners_[hand].ledBankWriteMicros(bank);
+    if (spent != 0 && spent + cost > budget_us) {
+      return false;
+    }
+    scanners_[hand].updateLedBank(bank);
+    spent += cost;
+  }
+}
+
 void Keyboard::setAllLeds(Color color) {
-  scanners_[0].updateAllLeds(color);
-  scanners_[1].updateAllLeds(color);
+  // A missing hand just gets the new color stored, to be sent when it comes back, and so
+  // do both while powered down
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (handPresent(hand) && ! power_down_.poweredDown()) {
+      scanners_[hand].updateAllLeds(color);
+    } else {
+      scanners_[hand].setLedColors(UINT32_MAX, color);
+    }
+  }
+#if MODEL01_LED_DOUBLE_BUFFER
+  // This one goes straight to the LEDs, so the back frame should match
+  for (Color& c : back_frame_) {
+    c = color;
+  }
+#endif
 }
 
 // My question here is why this is done in a separate setup() function; I suppose it's
@@ -99,19 +883,110 @@ void Keyboard::setup() {
   // boot up, to make it easier to rescue things
   // in case of power draw issues.
   enableHighPowerLeds();
-  memset(&curr_scan_, 0, sizeof(curr_scan_));
-  memset(&prev_scan_, 0, sizeof(prev_scan_));
+  memset(scan_slots_, 0, sizeof(scan_slots_));
+#if MODEL01_DEBOUNCE
+  memset(raw_slots_, 0, sizeof(raw_slots_));
+#endif
 
-  TWBR = 12; // This is 400mhz, which is the fastest we can drive the ATTiny
+  // This used to be fixed at 400kHz (TWBR = 12), which some keyboards' cables can't
+  // handle reliably, so now it gets measured
+  calibrateBusClock();
 
   // Turn off all LEDs at startup. TODO: move this elsewhere?
-  scanners_[0].updateAllLeds(Color{0,0,0});
-  scanners_[1].updateAllLeds(Color{0,0,0});
+  setAllLeds(Color{0,0,0});
 #if 0
   scanners_[0].testLeds();
   scanners_[1].testLeds();
 #endif
+
+#if MODEL01_TIMER_SCAN
+  startScanTimer();
+#endif
+}
+
+#if MODEL01_TIMER_SCAN
+static Keyboard* timer_scan_keyboard{nullptr};
+
+// Timer3 in CTC mode, with the clock divided by 8, so it counts in half microseconds (and
+// the longest period is about 32 ms)
+void Keyboard::startScanTimer() {
+  uint32_t period_us = MODEL01_TIMER_SCAN_US;
+  if (power_down_.poweredDown()) {
+    period_us = uint32_t(power_down_.idle_scan_period) * 1000;
+  }
+  // With the clock divided by 8, the 16-bit compare register only reaches 32 ms, so
+  // longer periods (like most idle ones) divide it by 64 instead, which reaches 262 ms
+  static_assert(uint32_t(F_CPU / 8 / 1000000) * MODEL01_TIMER_SCAN_US / 8 <= 0x10000,
+                "MODEL01_TIMER_SCAN_US is longer than Timer3 can count");
+  uint32_t ticks = (F_CPU / 8 / 1000000) * period_us;
+  byte prescaler = _BV(CS31);
+  if (ticks > 0x10000) {
+    ticks /= 8;
+    prescaler = _BV(CS31) | _BV(CS30);
+  }
+  timer_scan_keyboard = this;
+  TCCR3A = 0;
+  TCCR3B = _BV(WGM32) | prescaler;
+  OCR3A  = ticks - 1;
+  TCNT3  = 0;
+  TIMSK3 = _BV(OCIE3A);
+}
+
+// Stop the timer, and wait for the reads the last tick queued, so the bus is ours
+void Keyboard::stopScanTimer() {
+  TIMSK3 = 0;
+  TCCR3B = 0;
+  while (! twi_isIdle()) {}
+}
+
+// One scan cycle, in interrupt context. The reads queued on the last tick have had a
+// whole timer period to arrive, so they're collected first, then the next ones get
+// queued right away, and the changes go into the ring while they're on the bus.
+void Keyboard::timerScan() {
+  advanceScan();
+  collectHand(0);
+  collectHand(1);
+  requestHand(0);
+  requestHand(1);
+  recordTransitions();
+  queueEvents();
+}
+
+void Keyboard::queueEvents() {
+  Bits64 changes{currScan() ^ reported_.bits};
+  while (changes.bits != 0) {
+    byte addr = findFirstSet(changes);
+    clearFirstSet(changes);
+    byte& bank = reported_.bytes[addr / 8];
+    byte bit = byte(1) << (addr % 8);
+    byte event = addr;
+    if ((bank & bit) == 0) {
+      event |= events_.pressed_bit;
+    }
+    if (! events_.push(event)) {
+      return;
+    }
+    bank ^= bit;
+  }
+}
+
+bool Keyboard::nextEvent(KeyAddr& k, KeyState& state) {
+  byte event;
+  if (! events_.pop(event)) {
+    return false;
+  }
+  byte addr = event & events_.addr_mask;
+  bool pressed = event & events_.pressed_bit;
+  if (pressed) {
+    bitSet(delivered_.bytes[addr / 8], addr % 8);
+  } else {
+    bitClear(delivered_.bytes[addr / 8], addr % 8);
+  }
+  k = KeyAddr(addr);
+  state = KeyState(pressed, ! pressed);
+  return true;
 }
+#endif
 
 // why extern "C"? Because twi.c is not C++!
 extern "C" {
@@ -238,6 +1113,11 @@ void Keyboard::enableHighPowerLeds() {
   PORTB &= ~_BV(4);	// set bit, enable pull-up resistor
 }
 
+// Back to the USB limit, for when the LEDs are blanked or dimmed
+void Keyboard::disableHighPowerLeds() {
+  PORTE |= _BV(6);
+}
+
 
 boolean Keyboard::ledPowerFault() {
   if (PINB & _BV(4)) {
@@ -248,6 +1128,11 @@ boolean Keyboard::ledPowerFault() {
 }
 
 
+// Where the bootloader looks for its magic key
+#ifndef MAGIC_KEY_POS
+#define MAGIC_KEY_POS 0x0800
+#endif
+
 void Keyboard::rebootBootloader() {
   // Set the magic bits to get a Caterina-based device
   // to reboot into the bootloader and stay there, rather
@@ -257,7 +1142,7 @@ void Keyboard::rebootBootloader() {
   // Caterina.c
 
   uint16_t boot_key = 0x7777;
-  uint16_t* const boot_key_ptr = reinterpret_cast<uint16_t *>(0x0800);
+  uint16_t* const boot_key_ptr = reinterpret_cast<uint16_t *>(MAGIC_KEY_POS);
 
   // Stash the magic key
   *boot_key_ptr = boot_key;
@@ -271,9 +1156,19 @@ void Keyboard::rebootBootloader() {
 
 
 void Keyboard::setKeyscanInterval(uint8_t interval) {
-  scanners_[0].setKeyscanInterval(interval);
-  scanners_[1].setKeyscanInterval(interval);
+  keyscan_interval_ = interval;
+  for (byte hand{0}; hand < 2; ++hand) {
+    if (handPresent(hand)) {
+      scanners_[hand].setKeyscanInterval(interval);
+    }
+  }
 }
 
 } // namespace hardware {
 } // namespace kaleidoglyph {
+
+#if MODEL01_TIMER_SCAN
+ISR(TIMER3_COMPA_vect) {
+  kaleidoglyph::hardware::timer_scan_keyboard->timerScan();
+}
+#endif
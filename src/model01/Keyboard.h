@@ -4,7 +4,16 @@
 
 #include <Arduino.h>
 
+#include "model01/BitScan.h"
+#include "model01/BusClock.h"
+#include "model01/ChatterMonitor.h"
+#include "model01/Debouncer.h"
+#include "model01/EventRing.h"
+#include "model01/KeyAddrSet.h"
+#include "model01/KeyscanGovernor.h"
 #include "model01/KeyswitchData.h"
+#include "model01/PowerDown.h"
+#include "model01/Profiler.h"
 #include "model01/Color.h"
 #include "model01/LedAddr.h"
 #include "model01/KeyAddr.h"
@@ -17,9 +26,113 @@
 #include <kaleidoglyph/EventHandlerId.h>
 
 
+// Pipelined scanning: instead of collecting both hands at the start of each scan cycle,
+// scanMatrix() only waits for the left hand's data, and queues the read of the right
+// hand. That read is in flight while the Iterator compares the left hand's banks, and
+// when the Iterator gets to the right hand, it collects that data and queues the next
+// cycle's left-hand read. See Keyboard::scanMatrix() & Keyboard::finishScan().
+#ifndef MODEL01_PIPELINED_SCAN
+#define MODEL01_PIPELINED_SCAN 0
+#endif
+
+// Timer-driven scanning: Timer3 interrupts every MODEL01_TIMER_SCAN_US microseconds, and
+// the interrupt does the scanning. It collects the key reports that have come in, queues
+// the next reads, and puts any changes into a ring buffer, which the Iterator drains. The
+// scan rate then doesn't depend on how long the rest of the main loop takes. scanMatrix()
+// still needs to be called, for the things that can't be done in an interrupt: probing
+// for missing hands, recalibrating the bus clock, and the keyscan governor.
+#ifndef MODEL01_TIMER_SCAN
+#define MODEL01_TIMER_SCAN 0
+#endif
+
+#ifndef MODEL01_TIMER_SCAN_US
+#define MODEL01_TIMER_SCAN_US 1000
+#endif
+
+#if MODEL01_TIMER_SCAN && MODEL01_PIPELINED_SCAN
+#error "MODEL01_TIMER_SCAN and MODEL01_PIPELINED_SCAN can't be used together"
+#endif
+
+// Debouncing on the keyboard's MCU, in addition to the scanners' own. This makes it
+// possible to run the scanners at their fastest keyscan interval without letting chatter
+// through. See Debouncer.h.
+#ifndef MODEL01_DEBOUNCE
+#define MODEL01_DEBOUNCE 0
+#endif
+
+// Per-key timestamps: the time of each keyswitch's last transition, so plugins can ask
+// how long a key has been held (or released) with heldFor() & sinceRelease() instead of
+// keeping their own timers. This costs 136 bytes of RAM.
+#ifndef MODEL01_KEY_TIMESTAMPS
+#define MODEL01_KEY_TIMESTAMPS 0
+#endif
+
+// Chatter detection, with stricter debouncing for the keyswitches it catches (if
+// MODEL01_DEBOUNCE is on too). See ChatterMonitor.h. This costs about 90 bytes of RAM. In
+// timer mode, the monitor gets updated in the interrupt, so read it with interrupts off.
+#ifndef MODEL01_CHATTER_MONITOR
+#define MODEL01_CHATTER_MONITOR 0
+#endif
+
+// Double-buffered LED frames. The set*Color() functions draw into a back frame, and none
+// of it goes to the scanners until commitFrame() is called. Since a commit has to wait
+// until the previous frame has been completely sent, a frame never reaches the LEDs half
+// old and half new. This costs 128 bytes of RAM.
+#ifndef MODEL01_LED_DOUBLE_BUFFER
+#define MODEL01_LED_DOUBLE_BUFFER 0
+#endif
+
+// The back frame holds full colors, which would defeat the purpose of palette mode
+#if MODEL01_LED_DOUBLE_BUFFER && MODEL01_LED_PALETTE
+#error "MODEL01_LED_DOUBLE_BUFFER and MODEL01_LED_PALETTE can't be used together"
+#endif
+
 namespace kaleidoglyph {
 namespace hardware {
 
+#if MODEL01_PIPELINED_SCAN
+// Counters for checking that pipelined scanning actually overlaps the key reads with
+// event processing: `*_ready` counts how often the data was already there when it was
+// needed, and `wait_us` is the total time spent waiting for reads that weren't.
+struct ScanPipelineStats {
+  uint16_t cycles;
+  uint16_t left_ready;
+  uint16_t right_ready;
+  uint32_t wait_us;
+};
+#endif
+
+// A compact summary of one scan cycle, for controllers that want to consume key changes
+// in bulk instead of through the Iterator: one bit per keyswitch (in KeyAddr order) for
+// each one that changed state, and for each one that is currently pressed. If `changed`
+// is empty, the whole cycle can be skipped.
+struct KeyswitchChanges {
+  Bits64 changed;
+  Bits64 pressed;
+
+  bool empty() const {
+    return changed.bits == 0;
+  }
+
+  // Remove the lowest-addressed change from the set, and return its address & state.
+  // Returns false if there are no changes left.
+  bool pop(KeyAddr& k, KeyState& state) {
+    if (empty()) {
+      return false;
+    }
+    byte addr = findFirstSet(changed);
+    clearFirstSet(changed);
+    bool curr_state = bitRead(pressed.bytes[addr / 8], addr % 8);
+    k = KeyAddr(addr);
+    state = KeyState(curr_state, ! curr_state);
+    return true;
+  }
+};
+
+// Masks for the bulk LED functions: bit `n` of a KeyMask64 is KeyAddr `n`, and bit `n` of
+// a LedMask64 is LedAddr `n`
+typedef uint64_t KeyMask64;
+typedef uint64_t LedMask64;
 
 class Keyboard {
 
@@ -31,29 +144,166 @@ class Keyboard {
   // New API
   void scanMatrix();
 
+  // Scan, and return the results as a change set, computed in one pass over the scan
+  // data. In pipelined mode, this waits for the right hand's read instead of overlapping
+  // it with event processing.
+  void scanMatrix(KeyswitchChanges& changes);
+
   // I really don't think we need this function, but maybe it will be useful
   KeyState keyswitchState(KeyAddr k) const;
 
+  // The keyswitches that are pressed now, and the ones that were pressed or released in
+  // the current scan cycle. These are put together from the two hands' scan data in a
+  // couple of word-wide operations. In pipelined mode, they wait for the right hand's
+  // read, if it hasn't been collected yet. In timer mode, they go by the events the main
+  // loop has seen, and "the current scan cycle" means since the last call to scanMatrix().
+  KeyAddrSet pressedKeys();
+  KeyAddrSet pressedThisScan();
+  KeyAddrSet releasedThisScan();
+
+#if MODEL01_KEY_TIMESTAMPS
+  // The time in milliseconds since a keyswitch was pressed, if it's being held, or since
+  // it was released, if it isn't; otherwise zero. Both stop counting at about 32 seconds
+  // (`max_key_age`), rather than wrapping around.
+  uint16_t heldFor(KeyAddr k) const {
+    return timeInState(k, true);
+  }
+  uint16_t sinceRelease(KeyAddr k) const {
+    return timeInState(k, false);
+  }
+  static constexpr uint16_t max_key_age{0x7FFF};
+#endif
+
   // Update all LEDs to values set by set*Color() functions below
   bool syncLeds();
 
+  // Queue at most one LED write per hand (each scanner has one LED transaction, and
+  // they NACK writes that come back to back anyway), if we expect it to fit in
+  // `budget_us` microseconds of bus time. The bank that has been waiting longest goes
+  // first, so if the budget only has room for one write, it goes to the hand that needs
+  // it more. A hand whose last write is still on the bus gets nothing. Returns true if
+  // everything has been sent. Call it once per scan cycle; any budget beyond the cost of
+  // two bank writes makes no difference.
+  bool syncLedsOneWritePerHand(uint16_t budget_us);
+
   void setAllLeds(Color color);
   void testLeds();
 
+#if MODEL01_LED_DOUBLE_BUFFER
+  // Hand the back frame over to syncLeds(). If the previous frame is still being sent,
+  // this returns false and does nothing, so the caller can keep drawing and try again
+  // later.
+  bool commitFrame();
+#endif
+
   // These functions operate on LedAddr values, which are different from corresponding KeyAddr values
   Color getLedColor(LedAddr led) const;
   void  setLedColor(LedAddr led, Color color);
 
-  // These are the KeyAddr versions, which call the LedAddr functions
-  Color getKeyColor(KeyAddr k) const;
-  void  setKeyColor(KeyAddr k, Color color);
+  // These are the KeyAddr versions, which call the LedAddr functions. They're inline, so
+  // that the LED for a constant KeyAddr gets looked up at compile time.
+  Color getKeyColor(KeyAddr k) const {
+    return getLedColor(LedAddr{k});
+  }
+  void  setKeyColor(KeyAddr k, Color color) {
+    setLedColor(LedAddr{k}, color);
+  }
+
+  // Bulk versions of the above, for setting a lot of LEDs to the same color. Each LED bank
+  // gets updated in one pass, instead of one LED at a time.
+  void setLedColors(LedMask64 leds, Color color);
+  void setKeyColors(KeyMask64 keys, Color color);
+  // Set the LEDs from `begin` up to (but not including) `end`
+  void setLedRange(LedAddr begin, LedAddr end, Color color);
+  // Set all the LEDs in one physical row or column (see Layout.h)
+  void setRowColor(byte row, Color color);
+  void setColColor(byte col, Color color);
+
+#if MODEL01_LED_PALETTE
+  // Palette mode (see Scanner.h). Changing one palette entry marks only the LEDs that use
+  // it as changed. setPalette() replaces all sixteen entries at once, and marks every
+  // bank that uses any entry that's different.
+  Color getPaletteColor(byte index) const;
+  void  setPaletteColor(byte index, Color color);
+  void  setPalette(const Color palette[Scanner::palette_size]);
+
+  byte getLedPaletteIndex(LedAddr led) const;
+  void setLedPaletteIndex(LedAddr led, byte index);
+#endif
 
   // I'm leaving these functions alone for now; they shall remain mysterious
   void setup();
 
-  // This function is used by TestMode
+  // This function is used by TestMode. If the keyscan governor is enabled, it will
+  // override this setting the next time it changes the interval.
   void setKeyscanInterval(byte interval);
 
+  // Adaptive keyscan interval control; disabled by default. Set its parameters and
+  // `enabled` through this reference.
+  KeyscanGovernor& keyscanGovernor() {
+    return keyscan_governor_;
+  }
+
+  // Idle power-down; also disabled by default. See PowerDown.h.
+  PowerDown& powerDown() {
+    return power_down_;
+  }
+
+  // TWI error counts for each hand's scanner (0 is left, 1 is right); see Scanner.h
+  const TwiErrorStats& scannerErrors(byte hand) const {
+    return scanners_[hand].errorStats();
+  }
+  void resetScannerErrors() {
+    scanners_[0].resetErrorStats();
+    scanners_[1].resetErrorStats();
+  }
+
+  // Find the fastest TWI bus clock that both scanners can handle reliably (see
+  // BusClock.h). This gets called by setup(), and again if the error counts start
+  // rising. It blocks for a few tens of milliseconds.
+  void calibrateBusClock();
+  BusClock& busClock() {
+    return bus_clock_;
+  }
+
+  // False while a hand is unplugged (or its scanner has stopped answering)
+  bool handPresent(byte hand) const {
+    return ! hand_missing_[hand];
+  }
+
+#if MODEL01_DEBOUNCE
+  Debouncer& debouncer() {
+    return debouncer_;
+  }
+#endif
+
+#if MODEL01_CHATTER_MONITOR
+  const ChatterMonitor& chatterMonitor() const {
+    return chatter_monitor_;
+  }
+  // Changes to the chatter monitor go through these, with interrupts off, because in
+  // timer mode the interrupt might be in the middle of updating it
+  void releaseChatteringKey(KeyAddr k);
+  void releaseChatteringKeys();
+  void setChatterFiltering(bool filtering);
+  void setChatterLimits(uint16_t window, byte threshold);
+#endif
+
+#if MODEL01_TIMER_SCAN
+  // This gets called from the Timer3 interrupt, and shouldn't be called from anywhere
+  // else
+  void timerScan();
+#endif
+
+#if MODEL01_PIPELINED_SCAN
+  const ScanPipelineStats& pipelineStats() const {
+    return pipeline_stats_;
+  }
+  void resetPipelineStats() {
+    memset(&pipeline_stats_, 0, sizeof(pipeline_stats_));
+  }
+#endif
+
   /** @defgroup kaleidoscope_hardware_reattach Kaleidoscope::Hardware/Attach & Detach
    *
    * In situations where one wants to re-initialize the devices, perhaps to
@@ -90,18 +340,173 @@ class Keyboard {
 
   Scanner scanners_[2];
 
-  union KeyswitchScan {
-    KeyswitchData hands[2];
-    byte banks[total_keys / 8];  // CHAR_BIT
+  // The key scan state. Each hand's data is in one of three slots, and the current and
+  // previous scans are just slot indexes, so nothing gets copied from one to the other.
+  // A free slot is where the next key report goes: the TWI interrupt writes it there
+  // directly, and if it turns out to be a real report (see Scanner::collectKeys()), that
+  // slot becomes the current one. A hand without a new report has the same slot for both
+  // current & previous.
+  union KeyswitchHand {
+    KeyswitchData keys;
+    uint32_t bits;
   };
-  KeyswitchScan curr_scan_;
-  KeyswitchScan prev_scan_;
+  KeyswitchHand scan_slots_[2][3];
+  byte curr_slot_[2]{0, 0};
+  byte prev_slot_[2]{0, 0};
+  // where the key read that's in progress (if any) is going
+  byte next_slot_[2]{1, 1};
+
+  byte freeSlot(byte hand) const {
+    byte curr = curr_slot_[hand];
+    byte prev = prev_slot_[hand];
+    return (curr != prev) ? (3 - curr - prev) : (curr == 2) ? 0 : curr + 1;
+  }
+  static uint64_t joinHands(uint32_t left, uint32_t right) {
+    return (uint64_t(right) << 32) | left;
+  }
+  uint64_t currScan() const {
+    return joinHands(scan_slots_[0][curr_slot_[0]].bits, scan_slots_[1][curr_slot_[1]].bits);
+  }
+  uint64_t prevScan() const {
+    return joinHands(scan_slots_[0][prev_slot_[0]].bits, scan_slots_[1][prev_slot_[1]].bits);
+  }
+  byte currBank(byte bank) const {
+    byte hand = bank / sizeof(KeyswitchData);
+    return scan_slots_[hand][curr_slot_[hand]].keys.banks[bank % sizeof(KeyswitchData)];
+  }
+  byte prevBank(byte bank) const {
+    byte hand = bank / sizeof(KeyswitchData);
+    return scan_slots_[hand][prev_slot_[hand]].keys.banks[bank % sizeof(KeyswitchData)];
+  }
+  // Start a new scan cycle: the current scan becomes the previous one
+  void advanceScan() {
+    prev_slot_[0] = curr_slot_[0];
+    prev_slot_[1] = curr_slot_[1];
+  }
+
+#if MODEL01_DEBOUNCE
+  // With debouncing, the scanners' reports go into these instead (two per hand, for the
+  // same reason), and the scan slots hold the debounced state.
+  KeyswitchHand raw_slots_[2][2];
+  byte raw_slot_[2]{0, 0};
+  Debouncer debouncer_;
+#endif
+
+  // One scan cycle: everything scanMatrix() does, apart from the idle wait
+  void scanCycle();
+  bool receiveHand(byte hand);
+  void collectHand(byte hand);
+  // Set when a key report arrives, and cleared at the end of each scan cycle
+  bool key_report_{false};
+
+#if MODEL01_TIMER_SCAN
+  // The interrupt's side: `reported_` is the state that has been put in the ring so far.
+  // If the ring fills up, the changes that don't fit stay out of it until the next tick,
+  // so a press and release that both happen while it's full can get lost, but the state
+  // the main loop sees can't get out of sync.
+  Bits64 reported_{};
+  EventRing<32> events_;
+  void queueEvents();
+
+  // The main loop's side: the state as of the last event the Iterator returned, and as of
+  // the last call to scanMatrix()
+  Bits64 delivered_{};
+  Bits64 delivered_before_{};
+  bool nextEvent(KeyAddr& k, KeyState& state);
+
+  void startScanTimer();
+  void stopScanTimer();
+#endif
+
+  // Hot-plug handling. A hand whose scanner fails `missing_after_failures` key reads in a
+  // row is treated as unplugged: its keys are released, and it gets no transactions at
+  // all, except for a readVersion() probe every `probe_interval_ms`. When the probe gets
+  // an answer, the scanner gets the LED colors and keyscan interval it missed, and
+  // scanning picks up where it left off. Failed LED writes don't count towards this; a
+  // scanner that's busy might NACK one now and then, and they get sent again anyway.
+  static constexpr byte     missing_after_failures = 4;
+  static constexpr uint16_t probe_interval_ms      = 250;
+  bool hand_missing_[2]{false, false};
+  uint16_t last_probe_{0};
+  void requestHand(byte hand);
+  void detachHand(byte hand);
+  void probeMissingHands();
+
+  // The last interval sent to the scanners, so a reattached one can get it too
+  // (`no_change` means we haven't sent one, and they're using their own default)
+  byte keyscan_interval_{KeyscanGovernor::no_change};
+
+  BusClock bus_clock_;
+  uint16_t totalScannerErrors() const {
+    return scanners_[0].errorStats().total() + scanners_[1].errorStats().total();
+  }
+  bool busClockWorks(const byte versions[2]);
+  bool readHand(byte hand);
+
+  // The longest we'll wait for the bus to finish what's already on it, before giving up
+  // on a calibration or a probe. Draining a full queue at 100kHz takes a few ms; anything
+  // more than this means the bus is stuck, and the keyboard shouldn't hang with it.
+  static constexpr uint16_t bus_idle_timeout_us = 10000;
+  static bool waitForBusIdle();
+
+  KeyscanGovernor keyscan_governor_;
+  void updateActivity();
+
+  PowerDown power_down_;
+  // The keyscan interval to go back to on waking up
+  byte wake_keyscan_interval_{KeyscanGovernor::no_change};
+  void enterPowerDown();
+  void exitPowerDown();
+  void idleWait(uint16_t start);
+
+#if MODEL01_KEY_TIMESTAMPS || MODEL01_CHATTER_MONITOR
+  // The transitions get recorded in one pass over the changes whenever new key data has
+  // been collected (the end of scanMatrix(), finishScan(), or the timer tick), by
+  // comparing the scan state to the state as of the last pass.
+  Bits64 recorded_{};
+  void recordTransitions();
+#else
+  void recordTransitions() {}
+#endif
+
+#if MODEL01_KEY_TIMESTAMPS
+  // The low 16 bits of millis() at each keyswitch's last transition. Each pass also ages
+  // one key's stamp, so one that hasn't changed for more than `max_key_age` can't wrap
+  // around and look recent again.
+  uint16_t key_times_[total_keys]{};
+  byte next_to_age_{0};
+  uint16_t timeInState(KeyAddr k, bool pressed) const;
+#endif
+
+#if MODEL01_CHATTER_MONITOR
+  ChatterMonitor chatter_monitor_;
+#endif
+
+#if MODEL01_PIPELINED_SCAN
+  // Set when the right hand's read for the current cycle hasn't been collected yet
+  bool right_scan_pending_{false};
+  ScanPipelineStats pipeline_stats_{};
+
+  bool waitForKeys(byte hand);
+  void finishScan();
+#else
+  // Without pipelining, both hands are collected by scanMatrix()
+  void finishScan() {}
+#endif
 
   // LED updating
   static constexpr byte total_led_banks{4};
 
+  // the next LED bank that will be updated by syncLeds()
+  byte next_led_bank_{0};
+
+#if MODEL01_LED_DOUBLE_BUFFER
+  Color back_frame_[TOTAL_LEDS];
+#endif
+
   // special functions for Model01; make private if possible
   void enableHighPowerLeds();
+  void disableHighPowerLeds();
   void enableScannerPower();
   boolean ledPowerFault();
 
@@ -137,70 +542,133 @@ class Keyboard {
     byte addr_;
     KeyEvent event_;
 
+#if ! MODEL01_TIMER_SCAN
+    // One bit for each keyswitch that changed state in the current scan cycle, and
+    // hasn't been visited yet
+    Bits64 changes_;
+    bool diffed_{false};
+#if MODEL01_PIPELINED_SCAN
+    bool right_hand_diffed_{false};
+#endif
+
+    void diff(byte bank, byte end);
+#endif
+
   }; // class Iterator {
 
 }; // class Keyboard {
 
 
+#if MODEL01_TIMER_SCAN
+// With timer-driven scanning, the events come from the ring, in the order they happened
 inline bool Keyboard::Iterator::operator!=(const Iterator& other) {
-  // `r` stands for "row": really it's which set of eight keys we're testing, because the
-  // key scan data is stored as a bitfield.
-  byte r = addr_ / 8;  // 8 bits/byte
-
-  // First, the test for the end condition (return false when all the keyswitches have
-  // been tested)
-  while (addr_ < other.addr_) {
-
-    byte bank_prev = keyboard_.prev_scan_.banks[r];
-    byte bank_curr = keyboard_.curr_scan_.banks[r];
-
-    // Compare key scan data one byte at a time. The vast majority of the time, at most
-    // one keyswitch will have changed states, so it's much more efficient to compare them
-    // eight at a time, rather than one by one.
-    if (bank_curr != bank_prev) {
-
-      // When we find a row (byte) that has changed, we compare each bit until we find
-      // each one that has changed state:
-      for (byte c = addr_ % 8; c < 8; ++c) {  // 8 bits/byte
-
-        bool curr_state = bitRead(bank_curr, c);
-        bool prev_state = bitRead(bank_prev, c);
+  KeyAddr k;
+  KeyState state;
+  if (! keyboard_.nextEvent(k, state)) {
+    return false;
+  }
+  addr_ = byte(k);
+  event_.addr   = k;
+  event_.key    = cKey::blank;
+  event_.state  = state;
+  event_.caller = EventHandlerId::controller;
+  return true;
+}
 
-        if (curr_state != prev_state) {
-          // We found a keyswitch that changed state, so we update the iterator's index
-          // (`addr_`) and set the `event_` values accordingly before returning:
-          addr_ = (r * 8) + c;
+inline void Keyboard::Iterator::operator++() {}
+
+#else
+// Compare the current scan to the previous one, for the keyswitches in banks `bank`
+// through `end - 1`, and add any that changed state to the iterator's change set
+// (ignoring any that come before the iterator's starting address).
+inline void Keyboard::Iterator::diff(byte bank, byte end) {
+  MODEL01_PROFILE(diff);
+#if defined(__AVR__)
+  // One bank (register) at a time: a 64-bit XOR is eight of them anyway, and a variable
+  // 64-bit shift for the starting address would be a library call. Only the bank that
+  // the starting address is in needs a mask.
+  byte start = addr_ / 8;
+  if (bank < start) {
+    bank = start;
+  }
+  for (; bank < end; ++bank) {
+    byte changes = keyboard_.currBank(bank) ^ keyboard_.prevBank(bank);
+    if (bank == start) {
+      changes &= byte(0xFF << (addr_ % 8));
+    }
+    changes_.bytes[bank] |= changes;
+  }
+#else
+  uint64_t mask = ~uint64_t(0) << (bank * 8);
+  if (end < sizeof(changes_)) {
+    mask &= ~(~uint64_t(0) << (end * 8));
+  }
+  mask &= ~uint64_t(0) << addr_;
+  changes_.bits |= (keyboard_.currScan() ^ keyboard_.prevScan()) & mask;
+#endif
+}
 
-          event_.addr  = KeyAddr(addr_);
-          event_.key   = cKey::blank;
-          event_.state = KeyState(curr_state, prev_state);
-          event_.caller = EventHandlerId::controller;
+inline bool Keyboard::Iterator::operator!=(const Iterator& other) {
+  // The first time through, we XOR the whole scan state at once, instead of comparing it
+  // one bank (byte) at a time. The result has one bit set for each keyswitch that changed
+  // state, so from then on, we can jump straight to each of those keys.
+  if (! diffed_) {
+    diffed_ = true;
+    changes_.bits = 0;
+    if (addr_ >= other.addr_) {
+      return false;
+    }
+#if MODEL01_PIPELINED_SCAN
+    // The right hand's data may still be on its way, so just do the left hand for now
+    diff(0, sizeof(KeyswitchData));
+#else
+    diff(0, 2 * sizeof(KeyswitchData));
+#endif
+  }
 
-          // The `event_` will be returned by the dereference operator below, to be used
-          // in the body of the loop:
-          return true;
-        } // if (curr_state != prev_state) {
+  if (changes_.bits == 0) {
+#if MODEL01_PIPELINED_SCAN
+    // When we're done with the left hand, collect the right hand's data and continue
+    if (! right_hand_diffed_) {
+      right_hand_diffed_ = true;
+      keyboard_.finishScan();
+      diff(sizeof(KeyswitchData), 2 * sizeof(KeyswitchData));
+    }
+    if (changes_.bits == 0) {
+      return false;
+    }
+#else
+    return false;
+#endif
+  }
 
-      } // for (byte c = addr_ % 8; c < 8; ++c) { 
+  // We found a keyswitch that changed state, so we update the iterator's index (`addr_`)
+  // and set the `event_` values accordingly before returning:
+  addr_ = findFirstSet(changes_);
+  if (addr_ >= other.addr_) {
+    return false;
+  }
+  bool curr_state = bitRead(keyboard_.currBank(addr_ / 8), addr_ % 8);
 
-    }
+  event_.addr  = KeyAddr(addr_);
+  event_.key   = cKey::blank;
+  event_.state = KeyState(curr_state, ! curr_state);
+  event_.caller = EventHandlerId::controller;
 
-    // We're done checking one "row" (byte); move on to the next one:
-    ++r;
-    addr_ = r * 8;
+  // The `event_` will be returned by the dereference operator below, to be used in the
+  // body of the loop:
+  return true;
+}
 
-  } // while (addr_ < other.addr_) {
-  return false;
+inline void Keyboard::Iterator::operator++() {
+  clearFirstSet(changes_);
 }
+#endif
 
 inline KeyEvent& Keyboard::Iterator::operator*() {
   return event_;
 }
 
-inline void Keyboard::Iterator::operator++() {
-  ++addr_;
-}
-
 
 #if 0
 // To use the Keyboard::Iterator, write a loop like the following:
@@ -0,0 +1,65 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// Adaptive keyscan interval control. The governor watches key activity (reported once
+// per scan cycle by the Keyboard) and decides when the scanners should switch between a
+// fast keyscan interval, for low latency while typing, and a slow one, which cuts the
+// scanners' CPU load and power draw while the keyboard is idle. Intervals are in the
+// scanners' units (see Scanner::setKeyscanInterval()).
+//
+// Speeding up happens on the first scan cycle with any activity, because that's the one
+// that matters for latency. Slowing down only happens after `idle_timeout` ms without any
+// activity, and never less than `min_fast_time` ms after speeding up, so an occasional
+// isolated keypress doesn't make the interval flap back and forth (each change costs a
+// write to both scanners).
+class KeyscanGovernor {
+ public:
+  static constexpr byte no_change = 0xFF;
+
+  bool enabled{false};
+
+  byte fast_interval{0};   // 0.1-0.25 ms
+  byte slow_interval{50};  // 1.6 ms
+
+  uint16_t idle_timeout{2000};
+  uint16_t min_fast_time{250};
+
+  byte interval() const {
+    return fast_ ? fast_interval : slow_interval;
+  }
+
+  // Call once per scan cycle. `active` should be true if any keyswitch changed state, or
+  // is being held. Returns the new interval if it should change, or `no_change`.
+  byte update(bool active, uint16_t now) {
+    if (active) {
+      last_activity_ = now;
+      if (! fast_) {
+        fast_ = true;
+        fast_since_ = now;
+        return fast_interval;
+      }
+    } else if (fast_ &&
+               uint16_t(now - last_activity_) >= idle_timeout &&
+               uint16_t(now - fast_since_) >= min_fast_time) {
+      fast_ = false;
+      return slow_interval;
+    }
+    return no_change;
+  }
+
+ private:
+  // The scanners start out at their own default interval, which we treat as "slow"
+  bool fast_{false};
+  uint16_t last_activity_{0};
+  uint16_t fast_since_{0};
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
@@ -0,0 +1,53 @@
+// -*- c++ -*-
+
+#include "model01/Layout.h"
+
+#include "Kaleidoglyph-Hardware-Model01.h"
+
+namespace kaleidoglyph {
+namespace hardware {
+namespace layout {
+
+// The single definition of the PROGMEM table (Keys::table doesn't get one; see Layout.h)
+constexpr Tables Flash::tables;
+
+// KEYMAP_STACKED takes its arguments one hand at a time, in order of (row,col) position,
+// so the argument for each key should be that key's index in the sorted list. To check
+// that, we feed it the argument indexes, and compare the result with what we get by
+// sorting the layout table.
+constexpr byte stacked_order[] = KEYMAP_STACKED(
+   0,  1,  2,  3,  4,  5,  6,  7,
+   8,  9, 10, 11, 12, 13, 14, 15,
+  16, 17, 18, 19, 20, 21, 22, 23,
+  24, 25, 26, 27, 28, 29, 30, 31,
+  32, 33, 34, 35, 36, 37, 38, 39,
+  40, 41, 42, 43, 44, 45, 46, 47,
+  48, 49, 50, 51, 52, 53, 54, 55,
+  56, 57, 58, 59, 60, 61, 62, 63
+);
+
+constexpr byte sortKey(byte k) {
+  return Keys::table[k].pos + ((col(Keys::table[k].pos) < 9) ? 0 : 128);
+}
+constexpr byte stackedIndex(byte k, byte j = 0) {
+  return (j == total_keys) ? 0 :
+         (sortKey(j) < sortKey(k)) + stackedIndex(k, j + 1);
+}
+constexpr bool checkStackedOrder(byte k = 0) {
+  return (k == total_keys) ||
+         (stacked_order[k] == stackedIndex(k) && checkStackedOrder(k + 1));
+}
+static_assert(checkStackedOrder(), "KEYMAP_STACKED doesn't match the layout in Layout.h");
+
+// Likewise, every key should have its own LED & position
+constexpr bool checkInverse(byte k = 0) {
+  return (k == total_keys) ||
+         (Flash::tables.led_keys[Keys::table[k].led] == k &&
+          Flash::tables.pos_keys[Keys::table[k].pos] == k &&
+          checkInverse(k + 1));
+}
+static_assert(checkInverse(), "LED or position used twice in Layout.h");
+
+} // namespace layout {
+} // namespace hardware {
+} // namespace kaleidoglyph {
@@ -0,0 +1,200 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+
+namespace kaleidoglyph {
+namespace hardware {
+namespace layout {
+
+// This file is the one place where the Model01's physical layout is described. The
+// KeyAddr -> LedAddr mapping, its inverse, and the translation to & from (row,col)
+// coordinates are all generated from `Keys::table` below at compile time, so they can't
+// disagree with each other. The KEYMAP_STACKED macro can't be generated, but it gets
+// checked against the same table in Layout.cpp.
+
+constexpr byte total_keys = 64;
+constexpr byte total_rows =  6;
+constexpr byte total_cols = 18;
+
+// The value returned by the inverse lookups for positions that don't have a key
+constexpr byte invalid = 0xFF;
+
+// A physical position (row & column), encoded in one byte. Columns 0-8 are on the left
+// hand, and 9-17 are on the right.
+constexpr byte pos(byte r, byte c) {
+  return (r * total_cols + c);
+}
+constexpr byte row(byte pos) {
+  return pos / total_cols;
+}
+constexpr byte col(byte pos) {
+  return pos % total_cols;
+}
+
+struct Key {
+  byte pos;
+  byte led;
+};
+
+// The layout table is for compile time only: it's not in PROGMEM, and it deliberately
+// has no out-of-line definition, so reading it at run time is a link error, rather than
+// a copy of it taking up RAM. Everything that's needed at run time gets generated from it
+// into the one PROGMEM table below, which is a static member of a struct (rather than a
+// plain constexpr variable) so that there's only one copy of it, defined in Layout.cpp,
+// no matter how many files use it.
+struct Keys {
+  // The keys in KeyAddr order: each one's physical position, and the index of its LED
+  static constexpr Key table[total_keys] = {
+    {pos(4, 5), 27}, {pos(0, 6), 26}, {pos(0, 5), 20}, {pos(0, 4), 19},
+    {pos(0, 3), 12}, {pos(0, 2), 11}, {pos(0, 1),  4}, {pos(0, 0),  3},
+    {pos(4, 6), 28}, {pos(2, 6), 25}, {pos(1, 5), 21}, {pos(1, 4), 18},
+    {pos(1, 3), 13}, {pos(1, 2), 10}, {pos(1, 1),  5}, {pos(1, 0),  2},
+    {pos(4, 7), 29}, {pos(3, 6), 24}, {pos(2, 5), 22}, {pos(2, 4), 17},
+    {pos(2, 3), 14}, {pos(2, 2),  9}, {pos(2, 1),  6}, {pos(2, 0),  1},
+    {pos(4, 8), 30}, {pos(5, 6), 31}, {pos(3, 5), 23}, {pos(3, 4), 16},
+    {pos(3, 3), 15}, {pos(3, 2),  8}, {pos(3, 1),  7}, {pos(3, 0),  0},
+
+    {pos(0,17), 60}, {pos(0,16), 59}, {pos(0,15), 52}, {pos(0,14), 51},
+    {pos(0,13), 44}, {pos(0,12), 43}, {pos(0,11), 37}, {pos(4,12), 36},
+    {pos(1,17), 61}, {pos(1,16), 58}, {pos(1,15), 53}, {pos(1,14), 50},
+    {pos(1,13), 45}, {pos(1,12), 42}, {pos(2,11), 38}, {pos(4,11), 35},
+    {pos(2,17), 62}, {pos(2,16), 57}, {pos(2,15), 54}, {pos(2,14), 49},
+    {pos(2,13), 46}, {pos(2,12), 41}, {pos(3,11), 39}, {pos(4,10), 34},
+    {pos(3,17), 63}, {pos(3,16), 56}, {pos(3,15), 55}, {pos(3,14), 48},
+    {pos(3,13), 47}, {pos(3,12), 40}, {pos(5,11), 32}, {pos(4, 9), 33},
+  };
+};
+
+// The compile-time versions of the lookups. These also generate the PROGMEM table.
+constexpr byte keyToLed(byte k) {
+  return Keys::table[k].led;
+}
+constexpr byte keyToPos(byte k) {
+  return Keys::table[k].pos;
+}
+constexpr byte findLed(byte led, byte k = 0) {
+  return (k == total_keys)           ? invalid :
+         (Keys::table[k].led == led) ? k :
+         findLed(led, k + 1);
+}
+constexpr byte findPos(byte pos, byte k = 0) {
+  return (k == total_keys)           ? invalid :
+         (Keys::table[k].pos == pos) ? k :
+         findPos(pos, k + 1);
+}
+constexpr byte ledToKey(byte led) {
+  return findLed(led);
+}
+constexpr byte posToKey(byte pos) {
+  return findPos(pos);
+}
+
+template <byte... i>
+struct Sequence {};
+template <byte n, byte... i>
+struct MakeSequence : MakeSequence<n - 1, n - 1, i...> {};
+template <byte... i>
+struct MakeSequence<0, i...> {
+  typedef Sequence<i...> type;
+};
+
+// LED masks for each row & column, so they can be filled in one pass (bit `n` of each is
+// LedAddr `n`)
+constexpr uint64_t findRowLeds(byte r, byte k = 0) {
+  return (k == total_keys) ? 0 :
+         ((row(Keys::table[k].pos) == r) ? (uint64_t(1) << Keys::table[k].led) : 0) |
+         findRowLeds(r, k + 1);
+}
+constexpr uint64_t findColLeds(byte c, byte k = 0) {
+  return (k == total_keys) ? 0 :
+         ((col(Keys::table[k].pos) == c) ? (uint64_t(1) << Keys::table[k].led) : 0) |
+         findColLeds(c, k + 1);
+}
+constexpr uint64_t rowToLeds(byte r) {
+  return findRowLeds(r);
+}
+constexpr uint64_t colToLeds(byte c) {
+  return findColLeds(c);
+}
+
+// Everything the run-time lookups need, in one table: the keys (a copy of the layout
+// table), and the inverse mappings & line masks generated from them
+struct Tables {
+  Key keys[total_keys];
+  // KeyAddr values, indexed by LedAddr
+  byte led_keys[total_keys];
+  // KeyAddr values, indexed by position (`invalid` where there's no key)
+  byte pos_keys[total_rows * total_cols];
+  uint64_t row_leds[total_rows];
+  uint64_t col_leds[total_cols];
+};
+
+template <byte... k, byte... p, byte... r, byte... c>
+constexpr Tables generate(Sequence<k...>, Sequence<p...>, Sequence<r...>, Sequence<c...>) {
+  return {
+    { {keyToPos(k), keyToLed(k)}... },
+    { ledToKey(k)... },
+    { posToKey(p)... },
+    { rowToLeds(r)... },
+    { colToLeds(c)... },
+  };
+}
+
+struct Flash {
+  static constexpr PROGMEM Tables tables = generate(
+    MakeSequence<total_keys>::type{}, MakeSequence<total_rows * total_cols>::type{},
+    MakeSequence<total_rows>::type{}, MakeSequence<total_cols>::type{});
+};
+
+// The run-time lookups, which read from the PROGMEM table
+inline byte readKeyLed(byte k) {
+  return pgm_read_byte(&Flash::tables.keys[k].led);
+}
+inline byte readKeyPos(byte k) {
+  return pgm_read_byte(&Flash::tables.keys[k].pos);
+}
+inline byte readLedKey(byte led) {
+  return pgm_read_byte(&Flash::tables.led_keys[led]);
+}
+inline byte readPosKey(byte pos) {
+  return pgm_read_byte(&Flash::tables.pos_keys[pos]);
+}
+
+// The lookups to use everywhere else; there's no range checking, so that's up to the
+// caller. With a key address that's a compile-time constant (including one that only
+// becomes constant once the caller has been inlined), keyLed() & keyPos() use the
+// compile-time versions, which are a plain index into the layout table, so they fold to
+// a constant with no flash read, and they can be used in constant expressions. The
+// inverse lookups are searches at compile time, which the optimizer can't be trusted to
+// fold, so they always read the table; use ledToKey() & posToKey() for constants. The
+// constant check only works once these have been inlined, which -Os won't always do by
+// itself.
+__attribute__((always_inline)) constexpr byte keyLed(byte k) {
+  return __builtin_constant_p(k) ? keyToLed(k) : readKeyLed(k);
+}
+__attribute__((always_inline)) constexpr byte keyPos(byte k) {
+  return __builtin_constant_p(k) ? keyToPos(k) : readKeyPos(k);
+}
+inline byte ledKey(byte led) {
+  return readLedKey(led);
+}
+inline byte posKey(byte pos) {
+  return readPosKey(pos);
+}
+inline uint64_t rowLeds(byte r) {
+  uint64_t leds;
+  memcpy_P(&leds, &Flash::tables.row_leds[r], sizeof(leds));
+  return leds;
+}
+inline uint64_t colLeds(byte c) {
+  uint64_t leds;
+  memcpy_P(&leds, &Flash::tables.col_leds[c], sizeof(leds));
+  return leds;
+}
+
+} // namespace layout {
+} // namespace hardware {
+} // namespace kaleidoglyph {
@@ -5,6 +5,7 @@
 #include <Arduino.h>
 
 #include "model01/KeyAddr.h"
+#include "model01/Layout.h"
 
 
 namespace kaleidoglyph {
@@ -28,8 +29,16 @@ class LedAddr {
   explicit constexpr
   LedAddr(byte addr) : addr_{addr} {}
 
-  explicit
-  LedAddr(KeyAddr k);
+  // The mapping between KeyAddr & LedAddr values comes from Layout.h; with a constant
+  // KeyAddr, this gets folded to a constant, too (and can be used in a constant
+  // expression).
+  explicit constexpr
+  LedAddr(KeyAddr k) : addr_{hardware::layout::keyLed(k.addr())} {}
+
+  // The reverse of the above: the address of the key that this LED is under
+  KeyAddr keyAddr() const {
+    return KeyAddr(hardware::layout::ledKey(addr_));
+  }
 
   
   // Comparison operators for use with other LedAddr objects
@@ -84,8 +93,8 @@ class LedAddr {
     return tmp;
   }
 
-  explicit
-  operator byte() {
+  explicit constexpr
+  operator byte() const {
     return addr_;
   }
   // Maybe I should provide a cast operator to convert to LedAddr from KeyAddr?
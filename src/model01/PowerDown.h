@@ -0,0 +1,73 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "model01/Color.h"
+
+
+namespace kaleidoglyph {
+namespace hardware {
+
+// Idle power-down; disabled by default. Like the KeyscanGovernor, this only decides when
+// to change state, and the Keyboard does the rest. After `idle_timeout` seconds with no
+// key activity, the Keyboard powers down:
+//
+// - the scanners get `idle_keyscan_interval` (in their units; see
+//   Scanner::setKeyscanInterval()),
+// - all the LEDs get set to `idle_color` with one SET_ALL_TO per scanner, leaving the
+//   stored colors alone (black blanks them; a dim color leaves them glowing),
+// - the LEDs' high-power mode gets turned off, if `limit_led_power` is set, and
+// - scanning slows down to one cycle every `idle_scan_period` ms. If `sleep` is set, the
+//   MCU spends the time in between in idle sleep; otherwise it just waits. In timer mode,
+//   the scan timer slows down to match (any period up to the maximum of 255 ms fits).
+//
+// The first scan cycle with any activity wakes it up, and everything goes back the way
+// it was. The stored LED colors are sent again by syncLeds(), which sends nothing at all
+// while the keyboard is powered down.
+class PowerDown {
+ public:
+  bool enabled{false};
+
+  uint16_t idle_timeout{300};
+  byte idle_keyscan_interval{255};  // about 8 ms
+  byte idle_scan_period{8};
+  Color idle_color{0, 0, 0};
+  bool limit_led_power{true};
+  bool sleep{true};
+
+  enum Change : byte {
+    no_change,
+    power_down,
+    wake_up,
+  };
+
+  bool poweredDown() const {
+    return powered_down_;
+  }
+
+  // Call once per scan cycle. `active` should be true if any keyswitch changed state, or
+  // is being held. The timeout is in seconds, so this takes the full 32-bit millis().
+  Change update(bool active, uint32_t now) {
+    if (active) {
+      last_activity_ = now;
+      if (powered_down_) {
+        powered_down_ = false;
+        return wake_up;
+      }
+    } else if (enabled && ! powered_down_ &&
+               now - last_activity_ >= uint32_t(idle_timeout) * 1000) {
+      powered_down_ = true;
+      return power_down;
+    }
+    return no_change;
+  }
+
+ private:
+  bool powered_down_{false};
+  uint32_t last_activity_{0};
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
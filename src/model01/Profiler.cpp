@@ -0,0 +1,100 @@
+// -*- c++ -*-
+
+#include "model01/Profiler.h"
+
+#if MODEL01_PROFILER
+
+#include <avr/interrupt.h>
+
+namespace kaleidoglyph {
+namespace hardware {
+
+PhaseStats Profiler::stats_[byte(ProfilePhase::count)];
+
+// With MODEL01_TIMER_SCAN, some of the phases get recorded from the timer interrupt, so
+// the updates are done with interrupts off, to keep one from landing in the middle of
+// another.
+void Profiler::record(ProfilePhase phase, uint16_t elapsed_us) {
+  byte sreg = SREG;
+  cli();
+  update(stats_[byte(phase)], elapsed_us);
+  SREG = sreg;
+}
+
+void Profiler::update(PhaseStats& s, uint16_t elapsed_us) {
+  if (s.count == UINT16_MAX)
+    return;
+  if (s.count == 0 || elapsed_us < s.min_us)
+    s.min_us = elapsed_us;
+  if (elapsed_us > s.max_us)
+    s.max_us = elapsed_us;
+  ++s.count;
+  s.total_us += elapsed_us;
+
+  // The bucket is the index of the highest set bit (zero counts as one)
+  byte bucket{0};
+  for (uint16_t t = elapsed_us >> 1; t != 0; t >>= 1) {
+    ++bucket;
+  }
+  if (bucket >= PhaseStats::histogram_size)
+    bucket = PhaseStats::histogram_size - 1;
+  if (s.histogram[bucket] != UINT16_MAX)
+    ++s.histogram[bucket];
+}
+
+void Profiler::reset() {
+  byte sreg = SREG;
+  cli();
+  memset(stats_, 0, sizeof(stats_));
+  SREG = sreg;
+}
+
+static const __FlashStringHelper* phaseName(byte phase) {
+  switch (ProfilePhase(phase)) {
+    case ProfilePhase::scan_matrix:
+      return F("scan_matrix");
+    case ProfilePhase::read_keys:
+      return F("read_keys");
+    case ProfilePhase::diff:
+      return F("diff");
+    case ProfilePhase::led_bank:
+      return F("led_bank");
+    case ProfilePhase::sync_leds:
+      return F("sync_leds");
+    default:
+      return F("?");
+  }
+}
+
+// Each line is the phase name, then count, min, mean & max (in microseconds), then the
+// histogram buckets, from shortest to longest.
+void Profiler::dump(Print& out) {
+  out.println(F("phase count min mean max | <2us <4us <8us ... >=2048us"));
+  for (byte phase{0}; phase < byte(ProfilePhase::count); ++phase) {
+    // Take a copy, so the line is consistent, and interrupts aren't off while printing
+    byte sreg = SREG;
+    cli();
+    const PhaseStats s = stats_[phase];
+    SREG = sreg;
+    out.print(phaseName(phase));
+    out.print(' ');
+    out.print(s.count);
+    out.print(' ');
+    out.print(s.min_us);
+    out.print(' ');
+    out.print(s.meanMicros());
+    out.print(' ');
+    out.print(s.max_us);
+    out.print(F(" |"));
+    for (uint16_t n : s.histogram) {
+      out.print(' ');
+      out.print(n);
+    }
+    out.println();
+  }
+}
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
+
+#endif
@@ -0,0 +1,87 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+// A profiler for the phases of a scan cycle. When it's turned on, the hardware functions
+// time themselves with micros(), and the results are collected in a fixed block of RAM
+// (a bit under 200 bytes), which can be printed with Profiler::dump(). When it's off,
+// the MODEL01_PROFILE() macro expands to nothing, so there's no cost at all.
+#ifndef MODEL01_PROFILER
+#define MODEL01_PROFILER 0
+#endif
+
+#if MODEL01_PROFILER
+
+namespace kaleidoglyph {
+namespace hardware {
+
+enum class ProfilePhase : byte {
+  scan_matrix,  // Keyboard::scanMatrix()
+  read_keys,    // collecting one hand's key scan (and Scanner::readKeys())
+  diff,         // the Iterator's diff of the current & previous scans
+  led_bank,     // Scanner::updateLedBank()
+  sync_leds,    // Keyboard::syncLeds(), including its updateLedBank() calls
+  count
+};
+
+struct PhaseStats {
+  // Durations are in microseconds. The histogram has log2 buckets: bucket 0 counts times
+  // under 2us, bucket `n` counts times from 2^n up to 2^(n+1), and the last bucket also
+  // gets everything longer. All the counts stop at their maximum instead of wrapping.
+  static constexpr byte histogram_size = 12;
+
+  uint16_t count;
+  uint16_t min_us;
+  uint16_t max_us;
+  uint32_t total_us;
+  uint16_t histogram[histogram_size];
+
+  uint16_t meanMicros() const {
+    return (count == 0) ? 0 : total_us / count;
+  }
+};
+
+class Profiler {
+ public:
+  static void record(ProfilePhase phase, uint16_t elapsed_us);
+  static void reset();
+
+  // In timer scan mode, read these with interrupts off (or use dump(), which does)
+  static const PhaseStats& stats(ProfilePhase phase) {
+    return stats_[byte(phase)];
+  }
+
+  // Print a table of the results, one line per phase
+  static void dump(Print& out);
+
+  // Times everything from its construction to the end of its scope
+  class Timer {
+   public:
+    explicit Timer(ProfilePhase phase) : phase_(phase), start_(micros()) {}
+    ~Timer() {
+      record(phase_, uint16_t(micros()) - start_);
+    }
+   private:
+    ProfilePhase phase_;
+    uint16_t start_;
+  };
+
+ private:
+  static PhaseStats stats_[byte(ProfilePhase::count)];
+  static void update(PhaseStats& s, uint16_t elapsed_us);
+};
+
+} // namespace hardware {
+} // namespace kaleidoglyph {
+
+#define MODEL01_PROFILE(phase) \
+  kaleidoglyph::hardware::Profiler::Timer profile_timer_( \
+    kaleidoglyph::hardware::ProfilePhase::phase)
+
+#else
+
+#define MODEL01_PROFILE(phase)
+
+#endif
@@ -28,14 +28,11 @@ SOFTWARE.
 #include <Arduino.h>
 #include <assert.h>
 
+#include "model01/BitScan.h"
 #include "model01/Color.h"
 #include "model01/KeyswitchData.h"
 #include <kaleidoglyph/utils.h>
 
-// why extern "C"? Because twi.c is not C++!
-extern "C" {
-#include "twi/twi.h"
-}
 #include "twi/wire-protocol-constants.h"
 
 
@@ -69,10 +66,41 @@ const PROGMEM byte gamma8[] = {
 
 static bool twi_uninitialized = true;
 
+// Start out assuming the 400kHz that Keyboard::setup() sets: nine bit times per byte,
+// which is 22.5us
+volatile uint16_t Scanner::led_write_us_per_byte_x16_{22 * 16 + 8};
+twi_txn* Scanner::timed_led_txn_{nullptr};
+uint16_t Scanner::timed_led_start_;
+
 // Constructor
 Scanner::Scanner(byte ad01) {
   ad01_ = ad01;
   addr_ = SCANNER_I2C_ADDR_BASE | ad01_;
+  // The `data` pointers get set when the transactions are submitted, in case this object
+  // gets copied after construction.
+  key_txn_.address  = addr_;
+  key_txn_.flags    = TWI_TXN_READ | TWI_TXN_HEADER;
+  key_txn_.length   = key_reply_length_;
+  key_txn_.status   = 0;
+  key_txn_.count    = 0;
+  key_txn_.callback = nullptr;
+  key_txn_.header   = 0;
+  led_txn_.address  = addr_;
+  led_txn_.flags    = 0;
+  led_txn_.length   = sizeof(led_tx_buffer_);
+  led_txn_.status   = 0;
+  led_txn_.count    = 0;
+  led_txn_.callback = ledWriteDone;
+  led_txn_.header   = 0;
+  memset(&errors_, 0, sizeof(errors_));
+  failures_      = 0;
+  read_failures_ = 0;
+  backoff_       = 0;
+#if MODEL01_LED_WIRE_BUFFERS
+  for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+    led_wire_[bank][0] = TWI_CMD_LED_BASE + bank;
+  }
+#endif
   // I think twi_init() just sets things up on the controller, so it only gets called
   // once. Maybe this shouldn't be in the constructor, but in an init() method instead.
   if (twi_uninitialized) {
@@ -136,19 +164,173 @@ void Scanner::testLeds() {
 // member of the Scanner object. This reference parameter needs testing to see if it works
 // as I expect.
 bool Scanner::readKeys(KeyswitchData& key_data) {
-  byte rx_buffer[sizeof(key_data) + 1];
+  MODEL01_PROFILE(read_keys);
+  // perform blocking read into buffer (after any read that's already in progress)
+  KeyswitchData buffer;
+  twi_wait(&key_txn_);
+  if (! requestKeys(buffer))
+    return false;
+  twi_wait(&key_txn_);
+  if (! collectKeys())
+    return false;
+  key_data = buffer;
+  return true;
+}
 
-  // perform blocking read into buffer
-  /*byte read =*/ twi_readFrom(addr_, rx_buffer, arraySize(rx_buffer), true);
-  if (rx_buffer[0] == TWI_REPLY_KEYDATA) {
-    // memcpy(&key_data, &rx_buffer[1], sizeof(key_data));
-    for (byte i{0}; i < sizeof(key_data); ++i) {
-      key_data.banks[i] = rx_buffer[i + 1];
+bool Scanner::requestKeys(KeyswitchData& key_data) {
+  // Each call is one scan cycle, so this is where the backoff gets counted down
+  if (backoff_ != 0) {
+    --backoff_;
+    return false;
+  }
+  if (! twi_isDone(&key_txn_))
+    return false;
+  key_txn_.data = key_data.banks;
+  return twi_submit(&key_txn_) == 0;
+}
+
+bool Scanner::collectKeys() {
+  if (! twi_isDone(&key_txn_))
+    return false;
+  // Errors get counted once; then the transaction looks like one that's been collected
+  if (key_txn_.status != 0) {
+    countResult(key_txn_.status);
+    countReadFailure();
+    key_txn_.status = 0;
+    key_txn_.count  = 0;
+    return false;
+  }
+  // A count of zero means that we already collected it (or it was never requested)
+  if (key_txn_.count == 0)
+    return false;
+  byte count = key_txn_.count;
+  key_txn_.count = 0;
+  // The scanner replies with TWI_REPLY_NONE when there's nothing new to report, which
+  // isn't an error, but anything else other than a full key report is
+  if (count == key_reply_length_ && key_txn_.header == TWI_REPLY_NONE) {
+    failures_      = 0;
+    read_failures_ = 0;
+    return false;
+  }
+  if (count != key_reply_length_ || key_txn_.header != TWI_REPLY_KEYDATA) {
+    countFailure(errors_.bad_reply);
+    countReadFailure();
+    return false;
+  }
+  failures_      = 0;
+  read_failures_ = 0;
+  return true;
+}
+
+// Count a failed transfer, by its twi.c result code, and start (or extend) the backoff.
+// A result of zero is a success, which ends the run of failures.
+void Scanner::countResult(byte result) {
+  switch (result) {
+    case 0:
+      failures_ = 0;
+      break;
+    case 1:
+      countFailure(errors_.too_long);
+      break;
+    case 2:
+      countFailure(errors_.address_nack);
+      break;
+    case 3:
+      countFailure(errors_.data_nack);
+      break;
+    default:
+      countFailure(errors_.bus_error);
+  }
+}
+
+static void countUp(uint16_t& counter) {
+  if (counter != UINT16_MAX)
+    ++counter;
+}
+
+void Scanner::countReadFailure() {
+  if (read_failures_ != UINT8_MAX)
+    ++read_failures_;
+}
+
+void Scanner::countFailure(uint16_t& counter) {
+  countUp(counter);
+  if (failures_ != UINT8_MAX)
+    ++failures_;
+  byte backoff{1};
+  for (byte i{1}; i < failures_ && backoff < max_backoff_cycles_; ++i) {
+    backoff <<= 1;
+  }
+  backoff_ = backoff;
+}
+
+// Account for the last LED write, once it's finished. If it failed, the LEDs it was
+// sending get marked as changed again (which one it was, we can tell from its command
+// byte, which is still in the buffer). This runs in the main loop, so the counting is
+// done with interrupts off, in case a key read in the timer interrupt counts one too.
+void Scanner::checkLedWrite() {
+  if (led_txn_.status == 0) {
+    if (led_txn_.count != 0) {
+      led_txn_.count = 0;
+      failures_ = 0;
+    }
+    return;
+  }
+  byte sreg = SREG;
+  cli();
+  countResult(led_txn_.status);
+  SREG = sreg;
+  led_txn_.status = 0;
+  led_txn_.count  = 0;
+  const byte* data = led_txn_.data;
+  if (data[0] == TWI_CMD_LED_SET_ONE_TO) {
+    byte led = data[1];
+    markLedsChanged(led / leds_per_bank_, byte(1) << (led % leds_per_bank_));
+  } else if (data[0] == TWI_CMD_LED_SET_ALL_TO) {
+    for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+      markLedsChanged(bank, 0xFF);
     }
-    return true;
   } else {
+    markLedsChanged(data[0] - TWI_CMD_LED_BASE, 0xFF);
+  }
+}
+
+bool Scanner::probe() {
+  if (readVersion() == byte(-1))
     return false;
+  clearBackoff();
+  return true;
+}
+
+void Scanner::markAllLedsChanged() {
+  for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+    markLedsChanged(bank, 0xFF);
+  }
+}
+
+// The blocking writes try a few times before giving up, with a short pause before each
+// retry (the same one readRegister() gives the scanner between the write & the read), so
+// a scanner that's busy has a chance to catch up. Only the final outcome gets counted, so
+// a write that works on the second try isn't an error. Returns the last result code.
+byte Scanner::writeWithRetries(byte* data, byte length) {
+  byte sreg = SREG;
+  if (backoff_ != 0) {
+    cli();
+    countUp(errors_.dropped);
+    SREG = sreg;
+    return 4;
+  }
+  byte result = twi_writeTo(addr_, data, length, 1, 0);
+  for (byte attempt{1}; result != 0 && attempt < max_write_attempts_; ++attempt) {
+    delayMicroseconds(15);
+    result = twi_writeTo(addr_, data, length, 1, 0);
   }
+  cli();
+  countResult(result);
+  if (result != 0)
+    countUp(errors_.dropped);
+  SREG = sreg;
+  return result;
 }
 
 
@@ -157,7 +339,7 @@ Color Scanner::getLedColor(byte led) const {
   // byte bank = led / LEDS_PER_BANK;
   // led %= LEDS_PER_BANK;
   // return led_states_[bank][led];
-  return led_colors_[led];
+  return ledColor(led);
 }
 
 void Scanner::setLedColor(byte led, Color color) {
@@ -168,42 +350,239 @@ void Scanner::setLedColor(byte led, Color color) {
   //   led_states_[bank][led] = color;
   //   bitSet(led_banks_changed_, bank);
   // }
-  if (led_colors_[led] != color) {
-    led_colors_[led] = color;
-    byte bank = led / leds_per_bank_;
-    bitSet(led_banks_changed_, bank);
+  if (storeLedValue(led, ledValue(color))) {
+    markLedsChanged(led / leds_per_bank_, byte(1) << (led % leds_per_bank_));
+#if MODEL01_LED_WIRE_BUFFERS
+    encodeColor(ledWireColor(led), color);
+#endif
+  }
+}
+
+// This does the same thing as setLedColor(), but the change bits & timestamp only get
+// updated once per bank, and banks that aren't in `leds` get skipped entirely
+void Scanner::setLedColors(uint32_t leds, Color color) {
+  union {
+    uint32_t leds;
+    byte banks[led_banks_per_hand_];
+  } mask{leds};
+  LedValue value = ledValue(color);
+#if MODEL01_LED_WIRE_BUFFERS
+  byte wire[3];
+  encodeColor(wire, color);
+#endif
+  for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+    byte bank_mask = mask.banks[bank];
+    if (bank_mask == 0)
+      continue;
+    byte led = bank * leds_per_bank_;
+    byte changed{0};
+    for (byte i{0}; i < leds_per_bank_; ++i, ++led) {
+      if (bitRead(bank_mask, i) && storeLedValue(led, value)) {
+        bitSet(changed, i);
+#if MODEL01_LED_WIRE_BUFFERS
+        memcpy(&led_wire_[bank][1 + i * 3], wire, 3);
+#endif
+      }
+    }
+    if (changed != 0) {
+      markLedsChanged(bank, changed);
+    }
+  }
+}
+
+bool Scanner::storeLedValue(byte led, LedValue value) {
+#if MODEL01_LED_PALETTE
+  byte& indexes = led_indexes_[led / 2];
+  byte prev = indexes;
+  if (led & 1) {
+    indexes = (indexes & 0x0F) | (value << 4);
+  } else {
+    indexes = (indexes & 0xF0) | value;
+  }
+  bitSet(bank_palette_refs_[led / leds_per_bank_], value);
+  return indexes != prev;
+#else
+  if (led_colors_[led] == value)
+    return false;
+  led_colors_[led] = value;
+  return true;
+#endif
+}
+
+// Set the change bits for `leds` in `bank`, and if it was clean until now, note the time
+void Scanner::markLedsChanged(byte bank, byte leds) {
+  if (led_changed_.banks[bank] == 0) {
+    led_dirty_since_[bank] = millis();
   }
+  led_changed_.banks[bank] |= leds;
+}
+
+#if MODEL01_LED_PALETTE
+// Until an effect sets up its own palette, setLedColor() gets the closest of black, white,
+// the primary and secondary colors at full and half brightness, gray, and orange.
+Color Scanner::palette_[palette_size] = {
+  Color(  0,   0,   0), Color(255, 255, 255),
+  Color(255,   0,   0), Color(  0, 255,   0), Color(  0,   0, 255),
+  Color(255, 255,   0), Color(  0, 255, 255), Color(255,   0, 255),
+  Color(128,   0,   0), Color(  0, 128,   0), Color(  0,   0, 128),
+  Color(128, 128,   0), Color(  0, 128, 128), Color(128,   0, 128),
+  Color(128, 128, 128), Color(255, 128,   0),
+};
+
+// Find the palette entry closest to `color`. The distance is the sum of the squared
+// differences of the (5-bit) components.
+byte Scanner::paletteIndex(Color color) {
+  byte best{0};
+  uint16_t best_distance{UINT16_MAX};
+  for (byte i{0}; i < palette_size; ++i) {
+    Color entry = palette_[i];
+    int8_t dr = entry.r() - color.r();
+    int8_t dg = entry.g() - color.g();
+    int8_t db = entry.b() - color.b();
+    uint16_t distance = (dr * dr) + (dg * dg) + (db * db);
+    if (distance < best_distance) {
+      if (distance == 0)
+        return i;
+      best = i;
+      best_distance = distance;
+    }
+  }
+  return best;
+}
+
+void Scanner::setLedIndex(byte led, byte index) {
+  if (storeLedValue(led, index & 0x0F)) {
+    markLedsChanged(led / leds_per_bank_, byte(1) << (led % leds_per_bank_));
+  }
+}
+
+// For a single entry, we only mark the LEDs that use it. When more than one changed, it's
+// just the banks that use any of them, so a whole-palette swap costs one check per bank.
+void Scanner::markPaletteEntries(uint16_t entries) {
+  bool single = (entries & (entries - 1)) == 0;
+  for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+    uint16_t refs = bank_palette_refs_[bank] & entries;
+    if (refs == 0)
+      continue;
+    if (! single) {
+      markLedsChanged(bank, 0xFF);
+      continue;
+    }
+    byte led = bank * leds_per_bank_;
+    byte changed{0};
+    for (byte i{0}; i < leds_per_bank_; ++i, ++led) {
+      if (bitRead(entries, loadLedValue(led)))
+        bitSet(changed, i);
+    }
+    if (changed == 0) {
+      bank_palette_refs_[bank] &= ~entries;
+    } else {
+      markLedsChanged(bank, changed);
+    }
+  }
+}
+#endif
+
+// Write the gamma-corrected wire format of `color` (three bytes, in B-G-R order)
+void Scanner::encodeColor(byte* data, Color color) const {
+  data[0] = pgm_read_byte(&gamma8[color.b()]);
+  data[1] = pgm_read_byte(&gamma8[color.g()]);
+  data[2] = pgm_read_byte(&gamma8[color.r()]);
+}
+
+// Queue the LED write that's been set up in led_txn_. If the bus is idle, it will start
+// right away, so we can time it.
+void Scanner::submitLedWrite() {
+  if (twi_isIdle()) {
+    timed_led_txn_   = &led_txn_;
+    timed_led_start_ = micros();
+  }
+  twi_submit(&led_txn_);
+}
+
+// Completion callback for LED writes (called from the TWI interrupt). Each timed write
+// updates the throughput estimate by 1/8th of the difference.
+void Scanner::ledWriteDone(twi_txn* txn) {
+  if (txn != timed_led_txn_)
+    return;
+  timed_led_txn_ = nullptr;
+  if (txn->status != 0)
+    return;
+  uint16_t elapsed = uint16_t(micros()) - timed_led_start_;
+  // add one for the address byte
+  uint32_t sample = (uint32_t(elapsed) << 4) / (txn->length + 1);
+  if (sample > INT16_MAX)
+    sample = INT16_MAX;
+  led_write_us_per_byte_x16_ += (int16_t(sample) - int16_t(led_write_us_per_byte_x16_)) / 8;
+}
+
+// Write the wire format of the stored color of `led` -- with pre-encoded banks, there's
+// nothing to do but copy it
+void Scanner::copyLedColor(byte* data, byte led) {
+#if MODEL01_LED_WIRE_BUFFERS
+  memcpy(data, ledWireColor(led), 3);
+#else
+  encodeColor(data, ledColor(led));
+#endif
 }
 
 
 // This function gets called to set led status on one bank (eight LEDs) at a time. Each
 // time it's called, it updates the next bank. I'm renaming it to be more clear.
 void Scanner::updateNextLedBank() {
-  if (next_led_bank_ >= total_led_banks_) {
+  if (next_led_bank_ >= led_banks_per_hand_) {
     next_led_bank_ = 0;
   }
   updateLedBank(next_led_bank_++);
 }
 
 
-// This function is private, and only gets called by updateNextLedBank() (see above)
-void Scanner::updateLedBank(byte bank) {
-  // TODO: make this assert do something useful
-  assert(bank < total_led_banks_);
-  if (! bitRead(led_banks_changed_, bank))
-    return;
-  byte data[led_bytes_per_bank_ + 1];
+// This function gets called by updateNextLedBank() (see above) and Keyboard::syncLeds().
+// The write is queued, and carried out in the background by the TWI interrupt; the
+// buffer belongs to the transaction until it's finished, so if the previous one is still
+// in progress, we don't send anything and return false.
+bool Scanner::updateLedBank(byte bank) {
+  MODEL01_PROFILE(led_bank);
+  // There's nothing to send for a bank that doesn't exist
+  if (bank >= led_banks_per_hand_)
+    return true;
+  if (twi_isDone(&led_txn_))
+    checkLedWrite();
+  byte changed = led_changed_.banks[bank];
+  if (changed == 0)
+    return true;
+  if (! twi_isDone(&led_txn_) || backoff_ != 0)
+    return false;
+  byte* data = led_tx_buffer_;
+  led_txn_.data = led_tx_buffer_;
+
+  // If only a few LEDs in the bank have changed, it's cheaper to send them one at a time
+  // (one per call) than to send the whole bank.
+  byte changed_count = countBits8(changed);
+  if (ledBankCost(changed_count) < led_bank_cost_) {
+    byte i = findFirstSet8(changed);
+    byte led = bank * leds_per_bank_ + i;
+    data[0] = TWI_CMD_LED_SET_ONE_TO;
+    data[1] = led;
+    copyLedColor(&data[2], led);
+    led_txn_.length = 5;
+    submitLedWrite();
+    bitClear(led_changed_.banks[bank], i);
+    return changed_count == 1;
+  }
+
+#if MODEL01_LED_WIRE_BUFFERS
+  led_txn_.data = led_wire_[bank];
+#else
   data[0] = TWI_CMD_LED_BASE + bank;
   byte led = bank * leds_per_bank_;
   // I had a bug where we were running off the end of this array. It might still be
   // there. It might not actually be here, but in the caller, because `bank` might be out
   // of bounds.
-  for (byte i{0}; i <= led_bytes_per_bank_ - 3;) {
-    Color color = led_colors_[led++];
-    data[++i] = pgm_read_byte(&gamma8[color.b()]);
-    data[++i] = pgm_read_byte(&gamma8[color.g()]);
-    data[++i] = pgm_read_byte(&gamma8[color.r()]);
+  for (byte i{1}; i < led_bytes_per_bank_ + 1; i += 3) {
+    encodeColor(&data[i], ledColor(led++));
   }
+#endif
   // for (Color color : led_states_[bank]) {
   //   data[++i] = pgm_read_byte(&gamma8[color.b()]);
   //   data[++i] = pgm_read_byte(&gamma8[color.g()]);
@@ -211,8 +590,8 @@ void Scanner::updateLedBank(byte bank) {
   // }
   // TODO: get rid of this delay
   //delay(5);
-  //byte result =
-  twi_writeTo(addr_, data, sizeof(data), 1, 0);
+  led_txn_.length = led_bytes_per_bank_ + 1;
+  submitLedWrite();
   // while (byte result = twi_writeTo(addr_, data, sizeof(data), 1, 0)) {
   //   Serial.print(int(bank)), Serial.print(F(","));
   //   Serial.print(int(led)), Serial.print(F(": "));
@@ -223,49 +602,129 @@ void Scanner::updateLedBank(byte bank) {
   // Serial.print(int(bank));
   // Serial.print(F(": return code = "));
   // Serial.println(int(result));
-  bitClear(led_banks_changed_, bank);
+  led_changed_.banks[bank] = 0;
+  return true;
+}
+
+
+bool Scanner::updateAllLedsIfCheaper() {
+  if (! twi_isDone(&led_txn_))
+    return false;
+  checkLedWrite();
+  if (led_changed_.leds == 0 || backoff_ != 0)
+    return false;
+
+  // The SET_ALL_TO costs `led_all_cost_` by itself, so unless the bank writes would cost
+  // more than that, there's no need to look at the colors at all. If they would, but
+  // nothing has changed since the last time we looked, the answer is the same as then.
+  // (Not quite: new colors for LEDs that were already pending might tip the balance, but
+  // then we just miss a chance to save some bus time.)
+  uint16_t cost_banks{0};
+  for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+    cost_banks += ledBankCost(countBits8(led_changed_.banks[bank]));
+  }
+  if (cost_banks <= led_all_cost_ || led_changed_.leds == led_all_checked_)
+    return false;
+  led_all_checked_ = led_changed_.leds;
+
+  // The best candidate color is one of the pending ones; we use the first we find.
+  byte led{0};
+  while (! bitRead(led_changed_.banks[led / leds_per_bank_], led % leds_per_bank_)) {
+    ++led;
+  }
+  byte candidate = led;
+  LedValue value = loadLedValue(candidate);
+
+  // After a SET_ALL_TO, every LED that's a different color needs fixing up, whether or
+  // not it has changed.
+  uint16_t cost_all{led_all_cost_};
+  led = 0;
+  for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+    byte differ{0};
+    for (byte i{0}; i < leds_per_bank_; ++i) {
+      if (loadLedValue(led++) != value)
+        ++differ;
+    }
+    cost_all += ledBankCost(differ);
+  }
+  if (cost_all >= cost_banks)
+    return false;
+
+  byte* data = led_tx_buffer_;
+  data[0] = TWI_CMD_LED_SET_ALL_TO;
+  copyLedColor(&data[1], candidate);
+  led_txn_.data = led_tx_buffer_;
+  led_txn_.length = 4;
+  submitLedWrite();
+
+  led = 0;
+  uint16_t now = millis();
+  for (byte bank{0}; bank < led_banks_per_hand_; ++bank) {
+    byte differ{0};
+    for (byte i{0}; i < leds_per_bank_; ++i) {
+      if (loadLedValue(led++) != value)
+        bitSet(differ, i);
+    }
+    if (led_changed_.banks[bank] == 0) {
+      led_dirty_since_[bank] = now;
+    }
+    led_changed_.banks[bank] = differ;
+  }
+  return true;
 }
 
 
 // An efficient way to set the value of just one LED, without having to update everything
 void Scanner::updateLed(byte led, Color color) {
-  byte data[] = {TWI_CMD_LED_SET_ONE_TO,
-                 led,
-                 pgm_read_byte(&gamma8[color.b()]),
-                 pgm_read_byte(&gamma8[color.g()]),
-                 pgm_read_byte(&gamma8[color.r()])
-                };
-  while (byte result = twi_writeTo(addr_, data, arraySize(data), 1, 0)) {
-    Serial.print(int(led)); Serial.print(F(": ")); Serial.println(int(result));
-    // TODO: fix this so we don't need the delay at all. It may be that the best way is to
-    // guarantee that it only gets called once per scan cycle, or that updates are only
-    // allowed by whole banks or all LEDs at once.
-    //delay(2);
-  }
-  led_colors_[led] = color;
+  // In palette mode, we send the palette color, so the LED matches what's stored
+  LedValue value = ledValue(color);
+  color = valueColor(value);
+  byte data[] = {TWI_CMD_LED_SET_ONE_TO, led, 0, 0, 0};
+  encodeColor(&data[2], color);
+  byte result = writeWithRetries(data, arraySize(data));
+  storeLedValue(led, value);
+#if MODEL01_LED_WIRE_BUFFERS
+  memcpy(ledWireColor(led), &data[2], 3);
+#endif
+  // If it didn't get through, leave it for the next syncLeds() to send
+  if (result == 0) {
+    bitClear(led_changed_.banks[led / leds_per_bank_], led % leds_per_bank_);
+  } else {
+    markLedsChanged(led / leds_per_bank_, byte(1) << (led % leds_per_bank_));
+  }
   // byte bank = led / LEDS_PER_BANK;
   // led %= LEDS_PER_BANK;
   // led_states_[bank][led] = color;
 }
 
 
+bool Scanner::showAllLeds(Color color) {
+  byte data[] = {TWI_CMD_LED_SET_ALL_TO, 0, 0, 0};
+  encodeColor(&data[1], color);
+  return writeWithRetries(data, arraySize(data)) == 0;
+}
+
 // An efficient way to set all LEDs to the same color at once
 void Scanner::updateAllLeds(Color color) {
-  byte data[] = {TWI_CMD_LED_SET_ALL_TO,
-                 pgm_read_byte(&gamma8[color.b()]),
-                 pgm_read_byte(&gamma8[color.g()]),
-                 pgm_read_byte(&gamma8[color.r()])
-                };
-  byte result = twi_writeTo(addr_, data, arraySize(data), 1, 0);
+  LedValue value = ledValue(color);
+  color = valueColor(value);
+  byte data[] = {TWI_CMD_LED_SET_ALL_TO, 0, 0, 0};
+  encodeColor(&data[1], color);
+  byte result = writeWithRetries(data, arraySize(data));
   if (result != 0) return;
 
   // for (byte led{0}; led < leds_per_hand_; ++led) {
   //   led_colors_[led] = color;
   // }
 
-  for (Color& c : led_colors_) {
-    c = color;
+  for (byte led{0}; led < leds_per_hand_; ++led) {
+    storeLedValue(led, value);
+  }
+#if MODEL01_LED_WIRE_BUFFERS
+  for (byte led{0}; led < leds_per_hand_; ++led) {
+    memcpy(ledWireColor(led), &data[1], 3);
   }
+#endif
 
   // we should set all the values of led_states_ here
   // for (byte bank{0}; bank < total_led_banks_; ++bank) {
@@ -291,7 +750,7 @@ void Scanner::updateAllLeds(Color color) {
   //   led_states_.leds[led] = color;
   // }
 
-  led_banks_changed_ = 0;
+  led_changed_.leds = 0;
 }
 
 // Sets the keyscan interval. We currently do three reads.
@@ -313,7 +772,7 @@ void Scanner::updateAllLeds(Color color) {
 // https://www.arduino.cc/en/Reference/WireEndTransmission
 byte Scanner::setKeyscanInterval(byte delay) {
   byte data[] = {TWI_CMD_KEYSCAN_INTERVAL, delay};
-  byte result = twi_writeTo(addr_, data, arraySize(data), 1, 0);
+  byte result = writeWithRetries(data, arraySize(data));
 
   return result;
 }
@@ -324,7 +783,9 @@ byte Scanner::setKeyscanInterval(byte delay) {
 // This is called from other debugging functions
 byte Scanner::readRegister(byte cmd) {
   byte data[] = {cmd};
-  /*byte result =*/ twi_writeTo(addr_, data, arraySize(data), 1, 0);
+  // If nothing answers, there's no point in trying to read the reply
+  if (twi_writeTo(addr_, data, arraySize(data), 1, 0) != 0)
+    return -1;
 
   delayMicroseconds(15); // We may be able to drop this in the future
   // but will need to verify with correctly
@@ -366,7 +827,7 @@ byte Scanner::readLedSpiFrequency() {
 // https://www.arduino.cc/en/Reference/WireEndTransmission
 byte Scanner::setLedSpiFrequency(byte frequency) {
   byte data[] = {TWI_CMD_LED_SPI_FREQUENCY, frequency};
-  byte result = twi_writeTo(addr_, data, arraySize(data), 1, 0);
+  byte result = writeWithRetries(data, arraySize(data));
 
   return result;
 }
@@ -29,8 +29,35 @@ SOFTWARE.
 
 #include <Arduino.h>
 
+#include "model01/BitScan.h"
 #include "model01/Color.h"
 #include "model01/KeyswitchData.h"
+#include "model01/Profiler.h"
+
+// why extern "C"? Because twi.c is not C++!
+extern "C" {
+#include "twi/twi.h"
+}
+
+// Keep a copy of each scanner's LED banks in wire format (gamma-corrected, in B-G-R
+// order, with the bank's command byte in front). Colors get encoded once, in
+// setLedColor(), and a bank write just hands the buffer to the TWI layer. This costs an
+// extra 100 bytes of RAM per scanner, so it's off by default.
+#ifndef MODEL01_LED_WIRE_BUFFERS
+#define MODEL01_LED_WIRE_BUFFERS 0
+#endif
+
+// Palette mode: instead of a color for each LED, store a 4-bit index into a 16-entry
+// palette that's shared by both scanners. That cuts the LED color storage from 128 bytes
+// to 80. setLedColor() picks the closest palette entry; the default palette only has the
+// basic colors (see Scanner.cpp), so effects should set up their own first. Changing a palette entry only marks the LEDs that use it as changed.
+#ifndef MODEL01_LED_PALETTE
+#define MODEL01_LED_PALETTE 0
+#endif
+
+#if MODEL01_LED_PALETTE && MODEL01_LED_WIRE_BUFFERS
+#error "MODEL01_LED_PALETTE and MODEL01_LED_WIRE_BUFFERS can't be used together"
+#endif
 
 // See .cpp file for comments regarding appropriate namespaces
 namespace kaleidoglyph {
@@ -40,13 +67,49 @@ namespace hardware {
 constexpr byte LEDS_PER_BANK = 8;
 constexpr byte TOTAL_LEDS    = 64;
 
+// Error counts for one scanner's TWI transfers. The first four correspond to the result
+// codes from twi.c (1-4); "too long" can only come from the blocking writes. All of them
+// stop at their maximum instead of wrapping.
+struct TwiErrorStats {
+  uint16_t too_long;
+  uint16_t address_nack;
+  uint16_t data_nack;
+  uint16_t bus_error;
+  // Key data reads that finished, but with the wrong length or header byte
+  uint16_t bad_reply;
+  // Blocking writes that were abandoned after failing every attempt
+  uint16_t dropped;
+
+  // All the failed transfers (i.e. not counting `dropped`)
+  uint16_t total() const {
+    return too_long + address_nack + data_nack + bus_error + bad_reply;
+  }
+};
+
 // used to configure interrupts, configuration for a particular controller
 class Scanner {
  public:
   Scanner(byte ad01);
 
+  // A blocking key read, for testing. It shouldn't be mixed with the asynchronous reads
+  // below, because it would take their place.
   bool readKeys(KeyswitchData& key_data);
 
+  // Non-blocking version of readKeys(): requestKeys() queues a read on the TWI bus and
+  // returns immediately, and the transfer is carried out by the TWI interrupt, which
+  // writes the key data straight into `key_data` (the reply's header byte is kept in the
+  // transaction). Once keysReady() returns true, collectKeys() checks the reply, and
+  // returns true if `key_data` now holds a new key report. Anything else -- a read that's
+  // still in progress, failed, has already been collected, or a "nothing new" reply --
+  // returns false, and whatever is in `key_data` should be ignored, so it can't be a
+  // buffer that's in use. If a read is already in progress, requestKeys() returns false,
+  // and the data will go where that one was going.
+  bool requestKeys(KeyswitchData& key_data);
+  bool keysReady() const {
+    return twi_isDone(&key_txn_);
+  }
+  bool collectKeys();
+
   // I assume this will be used to detect different versions of the scanner firmware for
   // dealing with interface changes
   byte readVersion();
@@ -61,15 +124,137 @@ class Scanner {
   Color getLedColor(byte led) const;
   void  setLedColor(byte led, Color color);
 
+  // Set the color of every LED in `leds` (bit `n` is LED `n`), one bank at a time
+  void  setLedColors(uint32_t leds, Color color);
+
+#if MODEL01_LED_PALETTE
+  static constexpr byte palette_size = 16;
+
+  // The palette is shared by both scanners, so changing an entry doesn't mark any LEDs
+  // as changed by itself. Afterwards, call markPaletteEntries() on each scanner, with one
+  // bit set for each entry that changed (Keyboard::setPaletteColor() does that).
+  static Color getPaletteColor(byte index) {
+    return palette_[index];
+  }
+  static void  setPaletteColor(byte index, Color color) {
+    palette_[index] = color;
+  }
+  void markPaletteEntries(uint16_t entries);
+
+  byte getLedIndex(byte led) const {
+    return loadLedValue(led);
+  }
+  void setLedIndex(byte led, byte index);
+#endif
+
   // send message to controller to change physical LEDs
   void updateNextLedBank();
 
   void updateLed(byte led, Color color);
   void updateAllLeds(Color color);
 
+  // Set all the LEDs to one color on the scanner only, leaving the stored colors alone
+  // (e.g. to blank them while the keyboard is idle). markAllLedsChanged() gets them back.
+  bool showAllLeds(Color color);
+
   void testLeds();
 
-  void updateLedBank(byte bank);
+  // Queue an update of the changed LEDs in one bank, using whichever command puts fewer
+  // bytes on the bus: a full bank write, or a SET_ONE_TO for a single LED. Returns true if
+  // the bank is now up to date, and false if there's more to send (either because the
+  // previous LED write is still on the bus, or because it sent a single LED and there are
+  // others left).
+  bool updateLedBank(byte bank);
+
+  // If setting all LEDs to one color and then fixing up the ones that differ would be
+  // cheaper than sending the pending changes bank by bank, queue a SET_ALL_TO and return
+  // true.
+  bool updateAllLedsIfCheaper();
+
+  // True if there are LED changes that haven't been sent yet, or the last LED write is
+  // still on the bus
+  bool ledsPending() const {
+    // a failed write that hasn't been accounted for yet will mark its LEDs again
+    return led_changed_.leds != 0 || led_txn_.status != 0;
+  }
+
+  // These are for the time-budgeted LED scheduler in Keyboard::syncLedsOneWritePerHand().
+  // Banks get timestamped (with millis()) when they go from clean to dirty, so the ones
+  // that have been waiting longest can go first.
+  bool ledBankDirty(byte bank) const {
+    return led_changed_.banks[bank] != 0;
+  }
+  uint16_t ledBankDirtySince(byte bank) const {
+    return led_dirty_since_[bank];
+  }
+  bool ledWriteBusy() const {
+    return ! twi_isDone(&led_txn_);
+  }
+  // The time the next updateLedBank(bank) call's write is expected to take on the bus
+  uint16_t ledBankWriteMicros(byte bank) const {
+    byte bytes = (ledBankCost(countBits8(led_changed_.banks[bank])) < led_bank_cost_) ?
+                 led_one_cost_ : led_bank_cost_;
+    return ledWriteMicros(bytes);
+  }
+  static uint16_t ledAllWriteMicros() {
+    return ledWriteMicros(led_all_cost_);
+  }
+
+  // Error accounting. After a failed transfer, the scanner backs off: it skips the next
+  // 1, 2, 4... (up to max_backoff_cycles_) scan cycles, doubling with each consecutive
+  // failure, and sends nothing at all in the meantime. A failed LED write gets its LEDs
+  // marked as changed again, so nothing is lost; it just goes out later.
+  //
+  // With timer-driven scanning, the key reads get counted in the timer interrupt, and
+  // the LED writes in the main loop, so the main loop's updates to the counts (and to the
+  // run of failures & the backoff) are done with interrupts off. The counts are 16 bits,
+  // so reading them from the main loop should be done that way too.
+  const TwiErrorStats& errorStats() const {
+    return errors_;
+  }
+  void resetErrorStats() {
+    byte sreg = SREG;
+    cli();
+    memset(&errors_, 0, sizeof(errors_));
+    SREG = sreg;
+  }
+  // Put back counts saved earlier (for the bus clock calibration, whose failed trials at
+  // too-fast settings aren't real errors)
+  void restoreErrorStats(const TwiErrorStats& stats) {
+    byte sreg = SREG;
+    cli();
+    errors_ = stats;
+    SREG = sreg;
+  }
+  byte consecutiveFailures() const {
+    return failures_;
+  }
+  // Just the key reads: a NACKed LED write doesn't mean the hand is gone (it might just
+  // have been busy), but a scanner that doesn't answer key reads either really is
+  byte consecutiveReadFailures() const {
+    return read_failures_;
+  }
+  bool backingOff() const {
+    return backoff_ != 0;
+  }
+
+  // Check whether the scanner answers (by reading its version), without counting it as
+  // an error if it doesn't. If it does, its run of failures & backoff are cleared. This
+  // is for finding out when an unplugged hand comes back.
+  bool probe();
+
+  // Forget the run of failures, and try again right away
+  void clearBackoff() {
+    byte sreg = SREG;
+    cli();
+    failures_      = 0;
+    read_failures_ = 0;
+    backoff_       = 0;
+    SREG = sreg;
+  }
+
+  // Mark every LED as changed, so they all get sent again (e.g. after a reconnect)
+  void markAllLedsChanged();
 
  private:
   byte addr_;
@@ -77,13 +262,58 @@ class Scanner {
 
   byte readRegister(byte cmd);
 
+  // The number of times the blocking writes try before giving up, and the longest backoff
+  // (in scan cycles, i.e. calls to requestKeys())
+  static constexpr byte max_write_attempts_ = 3;
+  static constexpr byte max_backoff_cycles_ = 64;
+
+  TwiErrorStats errors_;
+  byte failures_;       // consecutive failed transfers
+  byte read_failures_;  // consecutive failed key reads
+  byte backoff_;        // scan cycles left to skip
+
+  void countResult(byte result);
+  void countFailure(uint16_t& counter);
+  void countReadFailure();
+  void checkLedWrite();
+  byte writeWithRetries(byte* data, byte length);
+
   // These constants might be wasting some space vs #define
   // static constexpr byte total_leds_         = TOTAL_LEDS;  // per controller
   static constexpr byte leds_per_hand_      = TOTAL_LEDS / 2;
   static constexpr byte leds_per_bank_      = LEDS_PER_BANK;   // CHAR_BIT
   static constexpr byte total_led_banks_    = TOTAL_LEDS / LEDS_PER_BANK;
+  static constexpr byte led_banks_per_hand_ = leds_per_hand_ / leds_per_bank_;
   static constexpr byte led_bytes_per_bank_ = LEDS_PER_BANK * 3;
 
+  // The number of bytes each LED command puts on the bus, including the address byte
+  static constexpr byte led_bank_cost_ = 1 + 1 + led_bytes_per_bank_;
+  static constexpr byte led_one_cost_  = 1 + 1 + 1 + 3;
+  static constexpr byte led_all_cost_  = 1 + 1 + 3;
+
+  static byte ledBankCost(byte changed_leds) {
+    byte cost = changed_leds * led_one_cost_;
+    return (cost < led_bank_cost_) ? cost : led_bank_cost_;
+  }
+
+  // Measured LED write throughput (in 1/16ths of a microsecond per byte), as a moving
+  // average. Both scanners are on the same bus, so they share it. We only time writes
+  // that start on an idle bus, because otherwise we don't know when they started.
+  static volatile uint16_t led_write_us_per_byte_x16_;
+  static twi_txn* timed_led_txn_;
+  static uint16_t timed_led_start_;
+  static void ledWriteDone(twi_txn* txn);
+  void submitLedWrite();
+
+  static uint16_t ledWriteMicros(byte bytes) {
+    // The TWI interrupt updates the estimate, and a 16-bit read isn't atomic
+    byte sreg = SREG;
+    cli();
+    uint16_t us_per_byte_x16 = led_write_us_per_byte_x16_;
+    SREG = sreg;
+    return (uint32_t(bytes) * us_per_byte_x16) >> 4;
+  }
+
   // This union stores the (pending) color data for all the LEDs controlled by this
   // scanner/controller
   // struct {
@@ -92,13 +322,88 @@ class Scanner {
   //   //byte banks[total_led_banks_][led_bytes_per_bank_];
   // } led_states_;
   // Color led_states_[total_led_banks_][leds_per_bank_];
+#if MODEL01_LED_PALETTE
+  // Each LED's value is its palette index, two to a byte
+  typedef byte LedValue;
+  byte led_indexes_[leds_per_hand_ / 2];
+
+  // Which palette entries each bank uses. These can be out of date, but only by having
+  // extra bits set; markPaletteEntries() clears the ones it finds to be stale.
+  uint16_t bank_palette_refs_[led_banks_per_hand_];
+
+  static Color palette_[palette_size];
+  static byte paletteIndex(Color color);
+
+  static LedValue ledValue(Color color) {
+    return paletteIndex(color);
+  }
+  static Color valueColor(LedValue value) {
+    return palette_[value];
+  }
+  LedValue loadLedValue(byte led) const {
+    byte indexes = led_indexes_[led / 2];
+    return (led & 1) ? (indexes >> 4) : (indexes & 0x0F);
+  }
+#else
+  // Without a palette, each LED's value is just its color
+  typedef Color LedValue;
   Color led_colors_[leds_per_hand_];
 
+  static LedValue ledValue(Color color) {
+    return color;
+  }
+  static Color valueColor(LedValue value) {
+    return value;
+  }
+  LedValue loadLedValue(byte led) const {
+    return led_colors_[led];
+  }
+#endif
+  Color ledColor(byte led) const {
+    return valueColor(loadLedValue(led));
+  }
+  // Store one LED's value, and return true if it changed
+  bool storeLedValue(byte led, LedValue value);
+  void markLedsChanged(byte bank, byte leds);
+
   // the next LED bank that will be updated by updateNextLedBank()
   byte next_led_bank_;
 
-  // bitfield storing which LED banks need an update
-  byte led_banks_changed_;
+  // bitfield storing which LEDs need an update, one byte per bank
+  union {
+    uint32_t leds;
+    byte banks[led_banks_per_hand_];
+  } led_changed_;
+  uint16_t led_dirty_since_[led_banks_per_hand_];
+
+  // The changed LEDs as of the last time updateAllLedsIfCheaper() looked at the colors and
+  // decided against a SET_ALL_TO, so it doesn't walk through them again on every call
+  uint32_t led_all_checked_{0};
+
+  void encodeColor(byte* data, Color color) const;
+  void copyLedColor(byte* data, byte led);
+
+#if MODEL01_LED_WIRE_BUFFERS
+  // Pre-encoded bank writes. The TWI layer reads straight from these, so a color that
+  // changes while its bank is on the bus might go out either way, but its bit in
+  // led_changed_ will be set again, so it gets sent on the next pass.
+  byte led_wire_[led_banks_per_hand_][led_bytes_per_bank_ + 1];
+
+  byte* ledWireColor(byte led) {
+    return &led_wire_[led / leds_per_bank_][1 + (led % leds_per_bank_) * 3];
+  }
+#endif
+
+  // Asynchronous TWI transactions, and the buffers they use. These must stay untouched
+  // while the transaction is in progress, so each type gets its own.
+  twi_txn key_txn_;
+  static constexpr byte key_reply_length_ = 1 + sizeof(KeyswitchData);
+  twi_txn led_txn_;
+#if MODEL01_LED_WIRE_BUFFERS
+  byte led_tx_buffer_[1 + 1 + 3];  // only needed for SET_ONE_TO & SET_ALL_TO
+#else
+  byte led_tx_buffer_[led_bytes_per_bank_ + 1];
+#endif
 
 }; // class Scanner {
 
@@ -53,6 +53,7 @@ static void (*twi_onSlaveTransmit)(void);
 static void (*twi_onSlaveReceive)(uint8_t*, int);
 
 static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
+static uint8_t* volatile twi_masterData;	// twi_masterBuffer, or the active txn's data
 static volatile uint8_t twi_masterBufferIndex;
 static volatile uint8_t twi_masterBufferLength;
 
@@ -67,6 +68,40 @@ static volatile uint8_t twi_rxBufferIndex;
 
 static volatile uint8_t twi_error;
 
+// queue of asynchronous transactions (see twi_submit)
+static twi_txn* volatile twi_activeTxn;
+static twi_txn* volatile twi_queueHead;
+static twi_txn* volatile twi_queueTail;
+// one if the active transaction's first byte is its header (TWI_TXN_HEADER)
+static volatile uint8_t twi_masterSkip;
+
+static void twi_sendStart(void);
+static uint8_t twi_result(void);
+static void twi_startTxn(twi_txn* txn);
+static void twi_advanceQueue(void);
+static void twi_receiveByte(uint8_t value);
+
+/*
+ * Function twi_acquire
+ * Desc     waits until the bus is free and no queued transactions are pending,
+ *          then claims it for a blocking transfer
+ * Input    state: TWI_MRX or TWI_MTX
+ * Output   none
+ */
+static void twi_acquire(uint8_t state) {
+  uint8_t sreg;
+  for (;;) {
+    sreg = SREG;
+    cli();
+    if (TWI_READY == twi_state && 0 == twi_activeTxn && 0 == twi_queueHead) {
+      twi_state = state;
+      SREG = sreg;
+      return;
+    }
+    SREG = sreg;
+  }
+}
+
 /*
  * Function twi_init
  * Desc     readys twi pins and sets twi bitrate
@@ -161,16 +196,15 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
   }
 
   // wait until twi is ready, become master receiver
-  while (TWI_READY != twi_state) {
-    continue;
-  }
-  twi_state = TWI_MRX;
+  twi_acquire(TWI_MRX);
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
   // initialize buffer iteration vars
+  twi_masterData = twi_masterBuffer;
   twi_masterBufferIndex = 0;
+  twi_masterSkip = 0;
   twi_masterBufferLength = length - 1; // This is not intuitive, read on...
   // On receive, the previously configured ACK/NACK setting is transmitted in
   // response to the received byte before the interrupt is signalled.
@@ -182,21 +216,7 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
   twi_slarw = TW_READ;
   twi_slarw |= address << 1;
 
-  if (true == twi_inRepStart) {
-    // if we're in the repeated start state, then we've already sent the start,
-    // (@@@ we hope), and the TWI statemachine is just waiting for the address byte.
-    // We need to remove ourselves from the repeated start state before we enable interrupts,
-    // since the ISR is ASYNC, and we could get confused if we hit the ISR before cleaning
-    // up. Also, don't enable the START interrupt. There may be one pending from the
-    // repeated start that we sent ourselves, and that would really confuse things.
-    twi_inRepStart = false;			// remember, we're dealing with an ASYNC ISR
-    do {
-      TWDR = twi_slarw;
-    } while (TWCR & _BV(TWWC));
-    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);	// enable INTs, but not START
-  } else
-    // send start condition
-    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+  twi_sendStart();
 
   // wait for read operation to complete
   while (TWI_MRX == twi_state) {
@@ -238,15 +258,13 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   }
 
   // wait until twi is ready, become master transmitter
-  while (TWI_READY != twi_state) {
-    continue;
-  }
-  twi_state = TWI_MTX;
+  twi_acquire(TWI_MTX);
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
   // initialize buffer iteration vars
+  twi_masterData = twi_masterBuffer;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length;
 
@@ -261,14 +279,31 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
 
   // if we're in a repeated start, then we've already sent the START
   // in the ISR. Don't do it again.
-  //
+  twi_sendStart();
+
+  // wait for write operation to complete
+  while (wait && (TWI_MTX == twi_state)) {
+    continue;
+  }
+
+  return twi_result();
+}
+
+/*
+ * Function twi_sendStart
+ * Desc     sends the start condition (or, if we're in a repeated start, the
+ *          address byte) for the transfer set up in twi_slarw
+ * Input    none
+ * Output   none
+ */
+static void twi_sendStart(void) {
   if (true == twi_inRepStart) {
     // if we're in the repeated start state, then we've already sent the start,
     // (@@@ we hope), and the TWI statemachine is just waiting for the address byte.
     // We need to remove ourselves from the repeated start state before we enable interrupts,
     // since the ISR is ASYNC, and we could get confused if we hit the ISR before cleaning
     // up. Also, don't enable the START interrupt. There may be one pending from the
-    // repeated start that we sent outselves, and that would really confuse things.
+    // repeated start that we sent ourselves, and that would really confuse things.
     twi_inRepStart = false;			// remember, we're dealing with an ASYNC ISR
     do {
       TWDR = twi_slarw;
@@ -277,16 +312,23 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   } else
     // send start condition
     TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);	// enable INTs
+}
 
-  // wait for write operation to complete
-  while (wait && (TWI_MTX == twi_state)) {
-    continue;
-  }
-
+/*
+ * Function twi_result
+ * Desc     translates the error state of the last transfer into a result code
+ * Input    none
+ * Output   0 .. success
+ *          2 .. address send, NACK received
+ *          3 .. data send, NACK received
+ *          4 .. other twi error (lost bus arbitration, bus error, ..)
+ */
+static uint8_t twi_result(void) {
   switch (twi_error) {
   case 0xFF:
     return 0;	// success
   case TW_MT_SLA_NACK:
+  case TW_MR_SLA_NACK:
     return 2;	// error: address send, nack received
   case TW_MT_DATA_NACK:
     return 3;	// error: data send, nack received
@@ -295,6 +337,156 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   }
 }
 
+/*
+ * Function twi_submit
+ * Desc     queues an asynchronous transaction; returns immediately. If the bus
+ *          is free, the transfer starts right away, otherwise the ISR starts it
+ *          as soon as the transactions ahead of it have finished. Safe to call
+ *          from a completion callback.
+ * Input    txn: transaction descriptor (address, flags, data & length set)
+ * Output   0 .. queued
+ *          1 .. zero length, or txn is already queued
+ */
+uint8_t twi_submit(twi_txn* txn) {
+  uint8_t sreg;
+
+  if (0 == txn->length) {
+    return 1;
+  }
+
+  sreg = SREG;
+  cli();
+  if (!twi_isDone(txn)) {
+    SREG = sreg;
+    return 1;
+  }
+  txn->next = 0;
+  txn->count = 0;
+  if (TWI_READY == twi_state && 0 == twi_activeTxn && 0 == twi_queueHead) {
+    twi_startTxn(txn);
+  } else {
+    txn->status = TWI_TXN_QUEUED;
+    if (twi_queueTail) {
+      twi_queueTail->next = txn;
+    } else {
+      twi_queueHead = txn;
+    }
+    twi_queueTail = txn;
+  }
+  SREG = sreg;
+  return 0;
+}
+
+/*
+ * Function twi_isDone
+ * Desc     checks whether a transaction has finished
+ * Input    txn: transaction descriptor
+ * Output   true if the transaction has finished (or was never submitted)
+ */
+uint8_t twi_isDone(const twi_txn* txn) {
+  return txn->status < TWI_TXN_QUEUED;
+}
+
+/*
+ * Function twi_wait
+ * Desc     waits for a transaction to finish
+ * Input    txn: transaction descriptor
+ * Output   the transaction's result code (see twi_writeTo)
+ */
+uint8_t twi_wait(twi_txn* txn) {
+  while (!twi_isDone(txn)) {
+    continue;
+  }
+  return txn->status;
+}
+
+/*
+ * Function twi_isIdle
+ * Desc     checks whether the bus is free and the transaction queue is empty
+ * Input    none
+ * Output   true if there's nothing in progress
+ */
+uint8_t twi_isIdle(void) {
+  return TWI_READY == twi_state && 0 == twi_activeTxn && 0 == twi_queueHead;
+}
+
+/*
+ * Function twi_startTxn
+ * Desc     becomes bus master for a queued transaction; must be called with
+ *          interrupts disabled (or from the ISR)
+ * Input    txn: transaction descriptor
+ * Output   none
+ */
+static void twi_startTxn(twi_txn* txn) {
+  twi_activeTxn = txn;
+  txn->status = TWI_TXN_ACTIVE;
+  twi_sendStop = true;
+  // reset error state (0xFF.. no error occured)
+  twi_error = 0xFF;
+
+  // the ISR works directly on the caller's buffer
+  twi_masterData = txn->data;
+  twi_masterBufferIndex = 0;
+  twi_masterSkip = (txn->flags & TWI_TXN_HEADER) ? 1 : 0;
+  if (txn->flags & TWI_TXN_READ) {
+    twi_state = TWI_MRX;
+    twi_masterBufferLength = txn->length - 1; // see twi_readFrom
+    twi_slarw = TW_READ;
+  } else {
+    twi_state = TWI_MTX;
+    twi_masterBufferLength = txn->length;
+    twi_slarw = TW_WRITE;
+  }
+  twi_slarw |= txn->address << 1;
+
+  twi_sendStart();
+}
+
+/*
+ * Function twi_receiveByte
+ * Desc     stores a byte received in master receiver mode (from the ISR)
+ * Input    value: the byte
+ * Output   none
+ */
+static void twi_receiveByte(uint8_t value) {
+  uint8_t i = twi_masterBufferIndex++;
+  if (i < twi_masterSkip) {
+    twi_activeTxn->header = value;
+  } else {
+    twi_masterData[i - twi_masterSkip] = value;
+  }
+}
+
+/*
+ * Function twi_advanceQueue
+ * Desc     called from the ISR whenever the bus has become ready: completes
+ *          the active transaction (if any) and starts the next queued one
+ * Input    none
+ * Output   none
+ */
+static void twi_advanceQueue(void) {
+  twi_txn* txn = twi_activeTxn;
+
+  if (txn) {
+    twi_activeTxn = 0;
+    txn->count = twi_masterBufferIndex;
+    txn->status = twi_result();
+    if (txn->callback) {
+      txn->callback(txn);
+    }
+  }
+
+  // the callback might have started a new transfer already
+  if (TWI_READY == twi_state && 0 == twi_activeTxn && twi_queueHead) {
+    txn = twi_queueHead;
+    twi_queueHead = txn->next;
+    if (0 == twi_queueHead) {
+      twi_queueTail = 0;
+    }
+    twi_startTxn(txn);
+  }
+}
+
 /*
  * Function twi_transmit
  * Desc     fills slave tx buffer with data
@@ -412,7 +604,7 @@ ISR(TWI_vect) {
     // if there is data to send, send it, otherwise stop
     if (twi_masterBufferIndex < twi_masterBufferLength) {
       // copy data to output register and ack
-      TWDR = twi_masterBuffer[twi_masterBufferIndex++];
+      TWDR = twi_masterData[twi_masterBufferIndex++];
       twi_reply(1);
     } else {
       if (twi_sendStop)
@@ -443,7 +635,7 @@ ISR(TWI_vect) {
   // Master Receiver
   case TW_MR_DATA_ACK: // data received, ack sent
     // put byte into buffer
-    twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+    twi_receiveByte(TWDR);
   case TW_MR_SLA_ACK:  // address sent, ack received
     // ack if more bytes are expected, otherwise nack
     if (twi_masterBufferIndex < twi_masterBufferLength) {
@@ -454,7 +646,7 @@ ISR(TWI_vect) {
     break;
   case TW_MR_DATA_NACK: // data received, nack sent
     // put final byte into buffer
-    twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+    twi_receiveByte(TWDR);
     if (twi_sendStop)
       twi_stop();
     else {
@@ -467,6 +659,7 @@ ISR(TWI_vect) {
     }
     break;
   case TW_MR_SLA_NACK: // address sent, nack received
+    twi_error = TW_MR_SLA_NACK;
     twi_stop();
     break;
     // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
@@ -558,5 +751,10 @@ ISR(TWI_vect) {
     twi_stop();
     break;
   }
+
+  // Once a transfer has ended, hand the bus to the next queued transaction
+  if (TWI_READY == twi_state) {
+    twi_advanceQueue();
+  }
 }
 
@@ -40,6 +40,35 @@
 #define TWI_SRX   3
 #define TWI_STX   4
 
+// Transaction status values. A transaction that has finished holds one of the same result
+// codes returned by twi_writeTo() (0 = success, 2 = address NACK, 3 = data NACK, 4 = other
+// error); these two values mean that it is still on its way.
+#define TWI_TXN_QUEUED  0xFE
+#define TWI_TXN_ACTIVE  0xFF
+
+// Transaction flags. With TWI_TXN_HEADER (reads only), the first byte received goes into
+// the descriptor's `header`, and the rest into `data`, so a reply with a header byte can
+// be received straight into a buffer that only has room for its payload. `length` and
+// `count` still include the header.
+#define TWI_TXN_READ    0x01
+#define TWI_TXN_HEADER  0x02
+
+// Descriptor for an asynchronous (queued) transaction. The caller owns both the
+// descriptor and the buffer it points to, and neither may be touched until the
+// transaction is done. The ISR reads from (or writes into) `data` directly, so there's no
+// length limit imposed by TWI_BUFFER_LENGTH.
+typedef struct twi_txn {
+  struct twi_txn* next;               // queue link; managed by the TWI module
+  uint8_t address;                    // 7-bit i2c device address
+  uint8_t flags;                      // TWI_TXN_READ, or zero for a write
+  uint8_t* data;                      // bytes to send, or buffer to receive into
+  uint8_t length;                     // number of bytes to send or receive
+  volatile uint8_t count;             // number of bytes actually transferred
+  volatile uint8_t status;            // TWI_TXN_* while in progress, then result code
+  void (*callback)(struct twi_txn*);  // called from the ISR on completion (optional)
+  uint8_t header;                     // first byte received, with TWI_TXN_HEADER
+} twi_txn;
+
 void twi_init(void);
 void twi_disable(void);
 void twi_setAddress(uint8_t);
@@ -53,5 +82,10 @@ void twi_reply(uint8_t);
 void twi_stop(void);
 void twi_releaseBus(void);
 
+uint8_t twi_submit(twi_txn*);
+uint8_t twi_isDone(const twi_txn*);
+uint8_t twi_wait(twi_txn*);
+uint8_t twi_isIdle(void);
+
 #endif
 
@@ -0,0 +1,402 @@
+// Host-side regression check: runs the key scan & LED paths of the Keyboard against the
+// simulated bus (see host.mk and src/host/SimBus.h), and exits non-zero if anything
+// doesn't arrive where it should. Build & run it with:
+//
+//   make -f host.mk check KALEIDOGLYPH_DIR=../Kaleidoglyph
+
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "model01/ChatterMonitor.h"
+#include "model01/Debouncer.h"
+#include "model01/Keyboard.h"
+#include "host/SimBus.h"
+
+using namespace kaleidoglyph;
+using kaleidoglyph::hardware::Keyboard;
+using kaleidoglyph::host::SimBus;
+
+static Keyboard keyboard;
+static int failures{0};
+
+#define CHECK(cond)                                                  \
+  do {                                                               \
+    if (! (cond)) {                                                  \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      ++failures;                                                    \
+    }                                                                \
+  } while (0)
+
+// One main loop iteration, with a bit of idle time. Returns the number of key events,
+// and the keys they were for.
+static byte cycle(uint64_t& event_keys) {
+  delay(1);
+  keyboard.scanMatrix();
+  byte events{0};
+  for (KeyEvent event : keyboard) {
+    event_keys |= uint64_t(1) << event.addr.addr();
+    ++events;
+  }
+  keyboard.syncLeds();
+  return events;
+}
+
+static byte run(int cycles, uint64_t& event_keys) {
+  byte events{0};
+  for (int i{0}; i < cycles; ++i) {
+    events += cycle(event_keys);
+  }
+  return events;
+}
+
+static void checkKeys() {
+  SimBus& bus = SimBus::instance();
+  uint64_t event_keys{0};
+
+  // Nothing pressed, nothing reported
+  CHECK(run(10, event_keys) == 0);
+
+  // One key on each hand: the left hand's scanner key 5 is KeyAddr 5, and the right
+  // hand's key 9 is KeyAddr 32 + 9
+  bus.scanner(0).setKey(5, true);
+  bus.scanner(1).setKey(9, true);
+  CHECK(run(10, event_keys) == 2);
+  CHECK(event_keys == ((uint64_t(1) << 5) | (uint64_t(1) << 41)));
+
+  // Holding them doesn't produce any more events
+  event_keys = 0;
+  CHECK(run(10, event_keys) == 0);
+
+  // Releasing them does
+  bus.scanner(0).setKey(5, false);
+  bus.scanner(1).setKey(9, false);
+  CHECK(run(10, event_keys) == 2);
+  CHECK(event_keys == ((uint64_t(1) << 5) | (uint64_t(1) << 41)));
+
+  // A whole bank on each side at once
+  const byte left[4]  = {0xFF, 0x00, 0x00, 0x00};
+  const byte right[4] = {0x00, 0x00, 0x00, 0x81};
+  const byte none[4]  = {};
+  bus.scanner(0).setKeys(left);
+  bus.scanner(1).setKeys(right);
+  event_keys = 0;
+  CHECK(run(10, event_keys) == 10);
+  bus.scanner(0).setKeys(none);
+  bus.scanner(1).setKeys(none);
+  CHECK(run(10, event_keys) == 10);
+}
+
+static void checkLeds() {
+  SimBus& bus = SimBus::instance();
+  uint64_t event_keys{0};
+
+  // Single LEDs on each hand; the colors arrive in B-G-R order, gamma-corrected, so only
+  // check which channels are lit
+  keyboard.setLedColor(LedAddr(5), Color(255, 0, 0));
+  keyboard.setLedColor(LedAddr(32 + 8), Color(0, 0, 255));
+  run(5, event_keys);
+  CHECK(bus.scanner(0).led(5).r != 0);
+  CHECK(bus.scanner(0).led(5).g == 0 && bus.scanner(0).led(5).b == 0);
+  CHECK(bus.scanner(1).led(8).b != 0);
+  CHECK(bus.scanner(1).led(8).r == 0 && bus.scanner(1).led(8).g == 0);
+  CHECK(bus.scanner(0).led(6).r == 0);
+
+  // All of them at once
+  keyboard.setAllLeds(Color(0, 255, 0));
+  run(5, event_keys);
+  for (byte i{0}; i < 32; ++i) {
+    CHECK(bus.scanner(0).led(i).g != 0 && bus.scanner(0).led(i).r == 0);
+    CHECK(bus.scanner(1).led(i).g != 0 && bus.scanner(1).led(i).b == 0);
+  }
+
+  // Changing one LED after that only changes that one
+  keyboard.setLedColor(LedAddr(63), Color(255, 0, 0));
+  run(5, event_keys);
+  CHECK(bus.scanner(1).led(31).r != 0 && bus.scanner(1).led(31).g == 0);
+  CHECK(bus.scanner(1).led(30).g != 0 && bus.scanner(1).led(30).r == 0);
+
+  // With nothing changed, syncLeds() sends nothing
+  uint32_t transactions = bus.transactions;
+  CHECK(keyboard.syncLeds());
+  CHECK(bus.transactions == transactions);
+}
+
+// Debouncer, without the Keyboard: each call is one scan cycle's reading of bank 0.
+// Returns the debounced state after the last of `scans` readings of `raw`.
+static byte debounce(hardware::Debouncer& debouncer, byte& state, byte raw, byte scans) {
+  while (scans-- > 0) {
+    debouncer.update(0, raw, state);
+  }
+  return state;
+}
+
+static void checkDebouncer() {
+  // The default: eager press, and release deferred for three scans
+  hardware::Debouncer debouncer;
+  byte state{0};
+  CHECK(debouncer.threshold() == 3);
+  CHECK(debounce(debouncer, state, 0x01, 1) == 0x01);
+  CHECK(debounce(debouncer, state, 0x00, 2) == 0x01);
+  CHECK(debounce(debouncer, state, 0x00, 1) == 0x00);
+
+  // Chatter on release: each bounce back restarts the count
+  CHECK(debounce(debouncer, state, 0x01, 1) == 0x01);
+  CHECK(debounce(debouncer, state, 0x00, 2) == 0x01);
+  CHECK(debounce(debouncer, state, 0x01, 1) == 0x01);
+  CHECK(debounce(debouncer, state, 0x00, 2) == 0x01);
+  CHECK(debounce(debouncer, state, 0x00, 1) == 0x00);
+
+  // Both directions deferred, for two scans; a one-scan glitch never gets through
+  debouncer.setThreshold(2);
+  debouncer.setPolicy(false, false);
+  CHECK(debounce(debouncer, state, 0x80, 1) == 0x00);
+  CHECK(debounce(debouncer, state, 0x00, 1) == 0x00);
+  CHECK(debounce(debouncer, state, 0x80, 1) == 0x00);
+  CHECK(debounce(debouncer, state, 0x80, 1) == 0x80);
+
+  // The keyswitches in a bank are counted separately
+  CHECK(debounce(debouncer, state, 0x81, 1) == 0x80);
+  CHECK(debounce(debouncer, state, 0x01, 1) == 0x81);
+  CHECK(debounce(debouncer, state, 0x01, 1) == 0x01);
+
+  // The threshold is limited to four scans
+  debouncer.setThreshold(9);
+  CHECK(debouncer.threshold() == 4);
+  CHECK(debounce(debouncer, state, 0x00, 3) == 0x01);
+  CHECK(debounce(debouncer, state, 0x00, 1) == 0x00);
+
+  // Strict keys get both directions deferred for four scans, whatever the policy is,
+  // and the others in the same bank keep theirs
+  hardware::Debouncer strict;
+  strict.setStrictKeys(hardware::KeyAddrSet{} + KeyAddr(0));
+  state = 0;
+  CHECK(debounce(strict, state, 0x03, 1) == 0x02);
+  CHECK(debounce(strict, state, 0x03, 2) == 0x02);
+  CHECK(debounce(strict, state, 0x03, 1) == 0x03);
+  CHECK(debounce(strict, state, 0x02, 3) == 0x03);
+  CHECK(debounce(strict, state, 0x03, 1) == 0x03);
+  CHECK(debounce(strict, state, 0x02, 4) == 0x02);
+
+  // Clearing them puts the key back on the eager path
+  strict.setStrictKeys(hardware::KeyAddrSet{});
+  CHECK(debounce(strict, state, 0x03, 1) == 0x03);
+}
+
+// ChatterMonitor, also without the Keyboard: each update is one scan cycle's changes
+static bool chatter(hardware::ChatterMonitor& monitor, KeyAddr k, byte transitions,
+                    uint16_t now) {
+  hardware::Bits64 changes{uint64_t(1) << k.addr()};
+  bool changed{false};
+  while (transitions-- > 0) {
+    changed |= monitor.update(changes, now);
+  }
+  return changed;
+}
+
+static void checkChatterMonitor() {
+  hardware::ChatterMonitor monitor;
+  monitor.window = 100;
+  monitor.threshold = 4;
+  KeyAddr k(17);
+
+  // Fewer than `threshold` transitions in a window is fine, and they're forgotten when
+  // the next window starts
+  CHECK(! chatter(monitor, k, 3, 0));
+  CHECK(monitor.transitions(k) == 3);
+  CHECK(! chatter(monitor, k, 3, 100));
+  CHECK(monitor.transitions(k) == 3 && ! monitor.isQuarantined(k));
+
+  // One more in the same window quarantines it, and changes the strict keys
+  CHECK(chatter(monitor, k, 1, 150));
+  CHECK(monitor.isQuarantined(k) && monitor.quarantineCount() == 1);
+  CHECK(monitor.strictKeys() == (hardware::KeyAddrSet{} + k));
+  CHECK(monitor.quarantined().count() == 1);
+
+  // Quarantine is sticky, and isn't counted again; the transitions saturate
+  CHECK(! chatter(monitor, k, 255, 250));
+  CHECK(monitor.transitions(k) == 255 && monitor.quarantineCount() == 1);
+  CHECK(! chatter(monitor, k, 1, 400) && monitor.isQuarantined(k));
+
+  // Without filtering, it's still quarantined, but not strict
+  monitor.setFiltering(false);
+  CHECK(monitor.update(hardware::Bits64{0}, 400));
+  CHECK(monitor.isQuarantined(k) && monitor.strictKeys().empty());
+  monitor.setFiltering(true);
+
+  // Releasing it starts it over
+  monitor.release(k);
+  CHECK(monitor.update(hardware::Bits64{0}, 400));
+  CHECK(! monitor.isQuarantined(k) && monitor.transitions(k) == 0);
+  CHECK(monitor.strictKeys().empty() && monitor.quarantineCount() == 1);
+  CHECK(! chatter(monitor, k, 3, 450));
+  monitor.releaseAll();
+  CHECK(monitor.transitions(k) == 0);
+}
+
+// Color math works on all three 5-bit channels at once, so check that nothing carries or
+// borrows from one channel into the next
+static void checkColor() {
+  Color red(255, 0, 0), green(0, 255, 0), blue(0, 0, 255), white(255, 255, 255);
+
+  // Adding saturates each channel by itself
+  CHECK(Color::add(red, red) == red);
+  CHECK(Color::add(red, blue) == Color(255, 0, 255));
+  CHECK(Color::add(white, white) == white);
+  Color sum = Color::add(Color(200, 16, 0), Color(100, 16, 0));
+  CHECK(sum.r() == 31 && sum.g() == 4 && sum.b() == 0);
+
+  // Scaling: 255 keeps the color, 0 makes it black, and 127 is half (of 31, rounded down)
+  CHECK(Color::scale(white, 255) == white);
+  CHECK(Color::scale(white, 0) == Color(0, 0, 0));
+  Color half = Color::scale(white, 127);
+  CHECK(half.r() == 15 && half.g() == 15 && half.b() == 15);
+
+  // Blending: the ends are the two colors, and halfway takes half of each
+  CHECK(Color::blend(red, blue, 0) == red);
+  CHECK(Color::blend(red, blue, 255) == blue);
+  Color mid = Color::blend(red, green, 127);
+  CHECK(mid.r() == 15 && mid.g() == 15 && mid.b() == 0);
+  CHECK(Color::average(red, blue) == Color(uint16_t(15 | (15 << 10))));
+
+  // The bulk versions do the same thing to each LED in a bank
+  Color bank[8] = {red, green, blue, white, red, green, blue, white};
+  const Color target[8] = {blue, blue, blue, blue, blue, blue, blue, blue};
+  Color::scale(bank, 0);
+  Color::add(bank, green);
+  Color::blend(bank, target, 255);
+  for (Color c : bank) {
+    CHECK(c == blue);
+  }
+}
+
+static void checkKeyAddrSet() {
+  using hardware::KeyAddrSet;
+  KeyAddrSet a = KeyAddrSet{} + KeyAddr(0) + KeyAddr(9) + KeyAddr(40);
+  KeyAddrSet b = KeyAddrSet{} + KeyAddr(9) + KeyAddr(63);
+
+  CHECK(KeyAddrSet{}.empty() && KeyAddrSet{}.count() == 0);
+  CHECK(a.count() == 3 && a.contains(KeyAddr(40)) && ! a.contains(KeyAddr(41)));
+  CHECK((a | b) == (KeyAddrSet{} + KeyAddr(0) + KeyAddr(9) + KeyAddr(40) + KeyAddr(63)));
+  CHECK((a & b) == (KeyAddrSet{} + KeyAddr(9)));
+  CHECK((a - b) == (KeyAddrSet{} + KeyAddr(0) + KeyAddr(40)));
+  CHECK(a.containsAll(a & b) && ! a.containsAll(b));
+  CHECK(a.containsAny(b) && ! (a - b).containsAny(b));
+
+  KeyAddrSet c{a};
+  c -= b;
+  c |= KeyAddrSet{} + KeyAddr(1);
+  c.remove(KeyAddr(0));
+  c &= KeyAddrSet{~uint64_t(0)};
+  CHECK(c == (KeyAddrSet{} + KeyAddr(1) + KeyAddr(40)));
+
+  // Iteration visits each key in the set once, lowest first
+  byte order[4];
+  byte n{0};
+  for (KeyAddr k : a | b) {
+    if (n < 4)
+      order[n] = k.addr();
+    ++n;
+  }
+  CHECK(n == 4);
+  CHECK(order[0] == 0 && order[1] == 9 && order[2] == 40 && order[3] == 63);
+  for (KeyAddr k : KeyAddrSet{}) {
+    (void)k;
+    CHECK(false);
+  }
+
+  // The Keyboard's sets, with one key held on each hand. The presses and releases show
+  // up in exactly one scan cycle each.
+  SimBus& bus = SimBus::instance();
+  KeyAddrSet held = KeyAddrSet{} + KeyAddr(5) + KeyAddr(32 + 9);
+  KeyAddrSet pressed, released;
+  uint64_t event_keys{0};
+  byte presses{0}, releases{0};
+  bus.scanner(0).setKey(5, true);
+  bus.scanner(1).setKey(9, true);
+  for (int i{0}; i < 10; ++i) {
+    cycle(event_keys);
+    presses += keyboard.pressedThisScan().count();
+    pressed |= keyboard.pressedThisScan();
+  }
+  CHECK(keyboard.pressedKeys() == held);
+  CHECK(pressed == held && presses == 2);
+  bus.scanner(0).setKey(5, false);
+  bus.scanner(1).setKey(9, false);
+  for (int i{0}; i < 10; ++i) {
+    cycle(event_keys);
+    releases += keyboard.releasedThisScan().count();
+    released |= keyboard.releasedThisScan();
+  }
+  CHECK(keyboard.pressedKeys().empty());
+  CHECK(released == held && releases == 2);
+}
+
+static void checkPowerDown() {
+  using hardware::PowerDown;
+  PowerDown power_down;
+  power_down.idle_timeout = 2;
+
+  // Disabled by default
+  CHECK(power_down.update(false, 100000) == PowerDown::no_change);
+  CHECK(! power_down.poweredDown());
+
+  // Powers down once, `idle_timeout` seconds after the last activity
+  power_down.enabled = true;
+  CHECK(power_down.update(true, 1000) == PowerDown::no_change);
+  CHECK(power_down.update(false, 2999) == PowerDown::no_change);
+  CHECK(power_down.update(false, 3000) == PowerDown::power_down);
+  CHECK(power_down.update(false, 9000) == PowerDown::no_change);
+  CHECK(power_down.poweredDown());
+
+  // Wakes up on the first activity, and starts the timeout over
+  CHECK(power_down.update(true, 10000) == PowerDown::wake_up);
+  CHECK(power_down.update(true, 10001) == PowerDown::no_change);
+  CHECK(power_down.update(false, 12000) == PowerDown::no_change);
+  CHECK(power_down.update(false, 12001) == PowerDown::power_down);
+  CHECK(power_down.update(true, 12002) == PowerDown::wake_up);
+
+  // The timeout still works when millis() wraps around
+  CHECK(power_down.update(true, 0xFFFFFC00) == PowerDown::no_change);
+  CHECK(power_down.update(false, 0x00000200) == PowerDown::no_change);
+  CHECK(power_down.update(false, 0x00000400) == PowerDown::power_down);
+
+  // The Keyboard, idle long enough to power down, and woken up by a key press
+  SimBus& bus = SimBus::instance();
+  uint64_t event_keys{0};
+  keyboard.powerDown().idle_timeout = 1;
+  keyboard.powerDown().idle_scan_period = 100;
+  keyboard.powerDown().enabled = true;
+  run(1100, event_keys);
+  CHECK(keyboard.powerDown().poweredDown());
+#if MODEL01_TIMER_SCAN
+  // A 100 ms period doesn't fit in Timer3 with the usual prescaler
+  CHECK((TCCR3B & 0x07) == (_BV(CS31) | _BV(CS30)) && OCR3A == 25000 - 1);
+#endif
+  bus.scanner(0).setKey(3, true);
+  CHECK(run(2, event_keys) == 1);
+  CHECK(! keyboard.powerDown().poweredDown());
+#if MODEL01_TIMER_SCAN
+  CHECK((TCCR3B & 0x07) == _BV(CS31));
+#endif
+  bus.scanner(0).setKey(3, false);
+  run(10, event_keys);
+  keyboard.powerDown().enabled = false;
+}
+
+int main() {
+  keyboard.setup();
+  checkKeys();
+  checkLeds();
+  checkDebouncer();
+  checkColor();
+  checkKeyAddrSet();
+  checkChatterMonitor();
+  checkPowerDown();
+  if (failures != 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}